@@ -0,0 +1,74 @@
+#include "apic.hpp"
+#include "cpu.hpp"
+#include "interrupts.hpp"
+#include "spinlock.hpp"
+#include "paging.hpp"
+#include "virtual_allocator.hpp"
+
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0b0
+#define LAPIC_SVR 0x0f0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+
+#define SVR_ENABLE 0x100
+
+#define ICR_FIXED 0x00000000
+#define ICR_INIT 0x00000500
+#define ICR_STARTUP 0x00000600
+#define ICR_ASSERT 0x00004000
+#define ICR_PENDING 0x00001000
+#define ICR_ALL_OTHERS 0x000c0000
+
+__constinit LocalApic LocalApic::instance;
+
+bool LocalApic::init(uintptr_t phys) {
+    auto regs = VirtualAllocator::global().map_physical(phys, PAGE_SIZE, MemoryType::Uncached);
+    m_regs = (volatile uint32_t*)regs;
+    return regs != 0;
+}
+
+void LocalApic::enable() {
+    // Accept every priority class
+    write(LAPIC_TPR, 0);
+    write(LAPIC_SVR, SVR_ENABLE | VECTOR_SPURIOUS);
+}
+
+void LocalApic::eoi() {
+    if (m_regs) {
+        write(LAPIC_EOI, 0);
+    }
+}
+
+uint32_t LocalApic::id() const {
+    return read(LAPIC_ID) >> 24;
+}
+
+void LocalApic::send_ipi(uint32_t apic_id, uint32_t command) {
+    // An interrupt handler sending an IPI of its own between the two
+    // writes would leave us with its destination
+    InterruptGuard interrupts;
+    write(LAPIC_ICR_HIGH, apic_id << 24);
+    write(LAPIC_ICR_LOW, command);
+    while (read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        cpu_relax();
+    }
+}
+
+void LocalApic::send_init(uint32_t apic_id) {
+    send_ipi(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void LocalApic::send_startup(uint32_t apic_id, uint8_t page) {
+    send_ipi(apic_id, ICR_STARTUP | ICR_ASSERT | page);
+}
+
+void LocalApic::send_fixed(uint32_t apic_id, uint8_t vector) {
+    send_ipi(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void LocalApic::send_all_others(uint8_t vector) {
+    // The destination field is ignored with a shorthand
+    send_ipi(0, ICR_FIXED | ICR_ASSERT | ICR_ALL_OTHERS | vector);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+// The local APIC, in xAPIC mode. Every CPU sees its own at the same
+// physical address, so one mapping serves them all.
+class LocalApic {
+public:
+    // Constant-initialized, so the EOI on every interrupt reaches it
+    // without a guard check
+    static LocalApic& global() { return instance; }
+
+    // Maps the registers at `phys`, from the MADT. Returns false if
+    // that fails.
+    bool init(uintptr_t phys);
+
+    // Software-enables the calling CPU's local APIC, with its spurious
+    // interrupts on VECTOR_SPURIOUS
+    void enable();
+
+    // Acknowledges the interrupt being handled on the calling CPU. Does
+    // nothing if the local APIC was never mapped, since then nothing
+    // could have been delivered through it.
+    void eoi();
+
+    // APIC ID of the calling CPU
+    uint32_t id() const;
+
+    // Sends INIT, or a startup IPI telling `apic_id` to start running
+    // real mode code at `page` << 12. These wait until the IPI has
+    // been sent.
+    void send_init(uint32_t apic_id);
+    void send_startup(uint32_t apic_id, uint8_t page);
+
+    // Sends a fixed interrupt on `vector` to every CPU but the caller
+    void send_all_others(uint8_t vector);
+    // Sends a fixed interrupt on `vector` to the CPU with `apic_id`
+    void send_fixed(uint32_t apic_id, uint8_t vector);
+
+private:
+    constexpr LocalApic() : m_regs() {}
+
+    static LocalApic instance;
+
+    uint32_t read(uint32_t reg) const { return m_regs[reg / 4]; }
+    void write(uint32_t reg, uint32_t value) { m_regs[reg / 4] = value; }
+
+    void send_ipi(uint32_t apic_id, uint32_t command);
+
+    volatile uint32_t* m_regs;
+};
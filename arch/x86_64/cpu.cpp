@@ -0,0 +1,26 @@
+#include "cpu.hpp"
+
+PER_CPU CpuLocal cpu_local_data;
+
+const CpuFeatures& CpuFeatures::global() {
+    static CpuFeatures features;
+    return features;
+}
+
+CpuFeatures::CpuFeatures() {
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    global_pages = d & (1 << 13);
+    pat = d & (1 << 16);
+    pcid = c & (1 << 17);
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    auto max_extended = a;
+
+    if (max_extended >= 0x80000001) {
+        cpuid(0x80000001, 0, &a, &b, &c, &d);
+        huge_pages = d & (1 << 26);
+    } else {
+        huge_pages = false;
+    }
+}
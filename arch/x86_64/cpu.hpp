@@ -0,0 +1,215 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "kmemlayout.h"
+#include "percpu.hpp"
+
+// Thin wrappers around privileged instructions that C++ can't express.
+
+inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+// CPUID is slow (and traps to the hypervisor under virtualization),
+// so the bits we care about are read once and kept here.
+class CpuFeatures {
+public:
+    static const CpuFeatures& global();
+
+    // 1GB pages
+    bool huge_pages;
+    // Global pages (CR4.PGE)
+    bool global_pages;
+    // Process-context identifiers (CR4.PCIDE)
+    bool pcid;
+    // Page attribute table
+    bool pat;
+
+private:
+    CpuFeatures();
+};
+
+inline uint64_t read_msr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+inline void write_msr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+inline uint64_t rdtsc() {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+inline void invlpg(uintptr_t addr) {
+    asm volatile ("invlpg (%0)" :: "r"(addr) : "memory");
+}
+
+inline uintptr_t read_cr2() {
+    uintptr_t value;
+    asm volatile ("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+inline uintptr_t read_cr3() {
+    uintptr_t value;
+    asm volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+inline void write_cr3(uintptr_t value) {
+    asm volatile ("mov %0, %%cr3" :: "r"(value) : "memory");
+}
+
+inline uintptr_t read_cr4() {
+    uintptr_t value;
+    asm volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+inline void write_cr4(uintptr_t value) {
+    asm volatile ("mov %0, %%cr4" :: "r"(value) : "memory");
+}
+
+// Upper bound on the number of CPUs we keep per-CPU state for
+#define MAX_CPUS 64
+
+// What each CPU keeps about itself
+struct CpuLocal {
+    unsigned index;
+    uint32_t apic_id;
+    // Top of the stack the CPU came up on
+    uintptr_t stack_top;
+};
+
+extern PER_CPU CpuLocal cpu_local_data;
+
+// CPU `index`'s CpuLocal. Only valid once alloc_percpu has given the
+// CPU its per-CPU area.
+inline CpuLocal& cpu_local(unsigned index) {
+    return per_cpu(cpu_local_data, index);
+}
+
+// Index of the CPU we're running on, in [0, cpu_count()). The boot
+// CPU is 0. Nothing that calls this (klog included) can run on a CPU
+// before its GS base is loaded.
+inline unsigned cpu_index() {
+    return this_cpu_read(cpu_local_data.index);
+}
+
+// CPUs that are up and running, the boot CPU included
+unsigned cpu_count();
+
+// Sends `cpu` an IPI on VECTOR_WAKEUP, to bring it out of halt()
+void wake_cpu(unsigned cpu);
+
+// Spin-wait hint
+inline void cpu_relax() {
+    asm volatile ("pause" ::: "memory");
+}
+
+inline void disable_interrupts() {
+    asm volatile ("cli" ::: "memory");
+}
+
+inline void enable_interrupts() {
+    asm volatile ("sti" ::: "memory");
+}
+
+// Disables interrupts, returning whether they were enabled
+inline bool save_interrupts() {
+    uint64_t flags;
+    asm volatile ("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+    return flags & (1 << 9);
+}
+
+inline void restore_interrupts(bool enabled) {
+    if (enabled) {
+        enable_interrupts();
+    }
+}
+
+inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    asm volatile ("inb %w1, %b0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+inline void outb(uint16_t port, uint8_t value) {
+    asm volatile ("outb %b0, %w1" :: "a"(value), "Nd"(port));
+}
+
+inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    asm volatile ("inl %w1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+inline void outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %w1" :: "a"(value), "Nd"(port));
+}
+
+inline void halt() {
+    asm volatile ("hlt" ::: "memory");
+}
+
+// Halts with interrupts enabled. sti only takes effect after the next
+// instruction, so an interrupt can't slip in between the two and be
+// missed: call this with interrupts disabled, after checking there's
+// nothing left to do.
+inline void enable_interrupts_and_halt() {
+    asm volatile ("sti; hlt" ::: "memory");
+}
+
+// Zeroes a page with `rep stosq`. The page ends up in the cache,
+// which is what we want if it's about to be used.
+inline void zero_page(void* page) {
+    size_t count = PAGE_SIZE / sizeof(uint64_t);
+    asm volatile ("rep stosq" : "+D"(page), "+c"(count) : "a"(0) : "memory");
+}
+
+inline void copy_page(void* dst, const void* src) {
+    size_t count = PAGE_SIZE / sizeof(uint64_t);
+    asm volatile ("rep movsq" : "+D"(dst), "+S"(src), "+c"(count) :: "memory");
+}
+
+// Copies `size` bytes, lowest address first
+inline void copy_forward(void* dst, const void* src, size_t size) {
+    asm volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) :: "memory");
+}
+
+// Copies `size` bytes, highest address first, for moving a range up
+// over itself
+inline void copy_backward(void* dst, const void* src, size_t size) {
+    if (!size) {
+        return;
+    }
+    auto d = (char*)dst + size - 1;
+    auto s = (const char*)src + size - 1;
+    asm volatile ("std\n\t"
+                  "rep movsb\n\t"
+                  "cld" : "+D"(d), "+S"(s), "+c"(size) :: "memory");
+}
+
+inline void fill_bytes(void* dst, uint8_t value, size_t size) {
+    asm volatile ("rep stosb" : "+D"(dst), "+c"(size) : "a"(value) : "memory");
+}
+
+// Zeroes a page with non-temporal stores, so zeroing pages ahead of
+// time doesn't push anything useful out of the cache.
+inline void zero_page_nt(void* page) {
+    auto words = (uint64_t*)page;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 4) {
+        asm volatile ("movnti %1, (%0)\n\t"
+                      "movnti %1, 8(%0)\n\t"
+                      "movnti %1, 16(%0)\n\t"
+                      "movnti %1, 24(%0)"
+                      :: "r"(words + i), "r"(0ul) : "memory");
+    }
+    asm volatile ("sfence" ::: "memory");
+}
@@ -1,36 +1,58 @@
 #include "stdint.h"
 
+#include "cxxabi.hpp"
 #include "logging.hpp"
 #include "allocator.hpp"
+#include "cpu.hpp"
 
-#define GUARD_INITIALIZED 1
-#define GUARD_ENABLE_INTERRUPTS 2
+// Bounds of the constructor table, from the linker script
+typedef void (*Constructor)();
+extern "C" const Constructor start_ctors[];
+extern "C" const Constructor end_ctors[];
 
+void run_global_constructors() {
+    for (auto ctor = start_ctors; ctor != end_ctors; ++ctor) {
+        (*ctor)();
+    }
+}
+
+// The guard object for a function-local static. The ABI makes it 64
+// bits, and compiled code tests the first byte inline, only calling
+// __cxa_guard_acquire while it's still 0. So that byte mustn't change
+// until the object is fully constructed.
 struct Guard {
+    uint8_t m_initialized;
+    // Whether the holder had interrupts enabled, so an interrupt handler
+    // can't deadlock on a guard its own CPU is holding
+    bool m_enable_interrupts;
+    uint16_t m_reserved;
     uint32_t m_lock;
-    uint32_t m_status;
 
     void lock() {
-        // TODO: disable interrupts to avoid reentrency here, and flag
-        // in the Guard structure if needed.
-        while(__sync_bool_compare_and_swap(&m_lock, 0, 1) == false) {}
+        auto enabled = save_interrupts();
+        while (__atomic_exchange_n(&m_lock, 1, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&m_lock, __ATOMIC_RELAXED)) {
+                cpu_relax();
+            }
+        }
+        m_enable_interrupts = enabled;
     }
 
     void unlock() {
-        __sync_bool_compare_and_swap(&m_lock, 1, 0);
-        if (m_status & GUARD_ENABLE_INTERRUPTS) {
-            // TODO: enable interrupts
-        }
+        auto enabled = m_enable_interrupts;
+        __atomic_store_n(&m_lock, 0, __ATOMIC_RELEASE);
+        restore_interrupts(enabled);
     }
 
     void initialize() {
-        m_status |= GUARD_INITIALIZED;
+        __atomic_store_n(&m_initialized, 1, __ATOMIC_RELEASE);
     }
 
     bool initialized() {
-        return m_status & GUARD_INITIALIZED;
+        return __atomic_load_n(&m_initialized, __ATOMIC_ACQUIRE);
     }
 };
+static_assert(sizeof(Guard) == 8, "The ABI's guard objects are 64 bits");
 
 extern "C" int __cxa_guard_acquire(Guard* guard) {
     if(guard->initialized()) {
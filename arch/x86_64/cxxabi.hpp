@@ -0,0 +1,7 @@
+#pragma once
+
+// Runs the constructors of every global with one, in the order the
+// linker script lays out .init_array. This comes early in kinit, with
+// logging but no heap, so global constructors must not allocate. The
+// core singletons are all constant-initialized and don't need it.
+void run_global_constructors();
@@ -0,0 +1,61 @@
+#include "descriptors.hpp"
+#include "kmemlayout.h"
+#include "cpu.hpp"
+
+#define GDT_ENTRIES 8
+
+// Present, 64-bit available TSS
+#define TSS_TYPE 0x89
+
+namespace {
+    struct CpuDescriptors {
+        uint64_t gdt[GDT_ENTRIES];
+        TaskStateSegment tss;
+    };
+
+    struct IstStacks {
+        alignas(16) char stacks[IST_STACKS][IST_STACK_SIZE];
+    };
+}
+
+// The same flat segments as the boot GDT in tables.S, plus the user
+// segments and each CPU's TSS
+static const uint64_t gdt_template[GDT_ENTRIES] = {
+    0x0000000000000000, // NULL descriptor
+    0x00af9a000000ffff, // Kernel CS
+    0x00cf92000000ffff, // Kernel DS
+    0x0000000000000000, // Unused 32-bit user CS
+    0x00affa000000ffff, // User CS
+    0x00cff2000000ffff, // User DS
+    0x0000000000000000, // TSS, filled in per CPU
+    0x0000000000000000,
+};
+
+static PER_CPU CpuDescriptors descriptors;
+static PER_CPU IstStacks ist_stacks;
+
+void load_cpu_descriptors(uintptr_t stack_top) {
+    auto& d = this_cpu(descriptors);
+    for (size_t i = 0; i < GDT_ENTRIES; ++i) {
+        d.gdt[i] = gdt_template[i];
+    }
+    d.tss = {};
+    d.tss.rsp[0] = stack_top;
+    auto& ist = this_cpu(ist_stacks);
+    for (size_t i = 0; i < IST_STACKS; ++i) {
+        d.tss.ist[i] = (uint64_t)(ist.stacks[i] + IST_STACK_SIZE);
+    }
+    // No I/O permission bitmap
+    d.tss.iomap_base = sizeof(TaskStateSegment);
+
+    auto base = (uint64_t)&d.tss;
+    uint64_t limit = sizeof(TaskStateSegment) - 1;
+    auto slot = CPU_STATE_SEGMENT / 8;
+    d.gdt[slot] = (limit & 0xffff) | (base & 0xffffff) << 16 |
+        (uint64_t)TSS_TYPE << 40 | (limit & 0xf0000) << 32 | (base & 0xff000000) << 32;
+    d.gdt[slot + 1] = base >> 32;
+
+    DescriptorPointer gdtr = {sizeof(d.gdt) - 1, (uint64_t)d.gdt};
+    asm volatile ("lgdt %0" :: "m"(gdtr));
+    asm volatile ("ltr %w0" :: "r"(CPU_STATE_SEGMENT));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "stdint.h"
+
+struct DescriptorPointer {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+// The 64-bit TSS. Without a ring 3 yet, all it holds is the stack for
+// coming into ring 0 and the interrupt stack table.
+struct TaskStateSegment {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+static_assert(sizeof(TaskStateSegment) == 104, "The TSS is 104 bytes");
+
+// Interrupt stack table slots. These exceptions can turn up on a stack
+// that's overflowed, or between any two instructions, so each CPU
+// takes them on a stack of their own.
+#define IST_DOUBLE_FAULT 1
+#define IST_NMI 2
+#define IST_MACHINE_CHECK 3
+#define IST_STACKS 3
+#define IST_STACK_SIZE 0x2000
+
+// Loads the calling CPU's own GDT and TSS, with `stack_top` as its ring 0
+// stack. The boot CPU does this to move off the boot GDT (which lives
+// in .nomap.reclaim), the others as they come up. The IDT is set up
+// by init_interrupts/load_interrupts.
+void load_cpu_descriptors(uintptr_t stack_top);
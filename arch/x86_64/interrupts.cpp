@@ -0,0 +1,275 @@
+#include "interrupts.hpp"
+#include "kmemlayout.h"
+#include "cpu.hpp"
+#include "descriptors.hpp"
+#include "demand_paging.hpp"
+#include "paging.hpp"
+#include "logging.hpp"
+#include "apic.hpp"
+#include "spinlock.hpp"
+
+// Entry points from isr.S, one per vector
+extern "C" const uint64_t isr_stubs[NUM_VECTORS];
+
+struct Gate {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+} __attribute__((packed));
+static_assert(sizeof(Gate) == 16, "IDT gates are 16 bytes");
+
+// Present, DPL 0, 64-bit interrupt gate
+#define GATE_INTERRUPT 0x8E
+
+namespace {
+    struct VectorStats {
+        uint64_t count;
+        uint32_t latency[LATENCY_BUCKETS];
+    };
+}
+
+// Every CPU loads a copy of `gates` of its own
+static Gate gates[NUM_VECTORS];
+static PER_CPU Gate idt[NUM_VECTORS];
+
+// Handler chains are walked without a lock, so changes to them are
+// made under chain_lock and published with atomic stores
+static InterruptAction* chains[NUM_VECTORS];
+static SpinLock chain_lock;
+static unsigned next_vector = VECTOR_DEVICE_FIRST;
+
+static PER_CPU VectorStats vector_stats[NUM_VECTORS];
+
+static const char* exception_names[NUM_EXCEPTIONS] = {
+    "divide error",
+    "debug",
+    "NMI",
+    "breakpoint",
+    "overflow",
+    "bound range exceeded",
+    "invalid opcode",
+    "device not available",
+    "double fault",
+    "coprocessor segment overrun",
+    "invalid TSS",
+    "segment not present",
+    "stack fault",
+    "general protection fault",
+    "page fault",
+    "reserved",
+    "x87 floating point",
+    "alignment check",
+    "machine check",
+    "SIMD floating point",
+    "virtualization",
+    "control protection",
+    "reserved",
+    "reserved",
+    "reserved",
+    "reserved",
+    "reserved",
+    "reserved",
+    "hypervisor injection",
+    "VMM communication",
+    "security",
+    "reserved",
+};
+
+// Taking the interrupt is the point, so there's nothing to do
+static bool wakeup(InterruptFrame*, void*) {
+    return true;
+}
+
+static InterruptAction wakeup_action = {wakeup, nullptr, "wakeup", nullptr};
+
+void init_interrupts() {
+    for (size_t i = 0; i < NUM_VECTORS; ++i) {
+        auto addr = isr_stubs[i];
+        gates[i] = {
+            (uint16_t)addr,
+            KERNEL_CODE_SEGMENT,
+            0,
+            GATE_INTERRUPT,
+            (uint16_t)(addr >> 16),
+            (uint32_t)(addr >> 32),
+            0,
+        };
+    }
+    gates[VECTOR_DOUBLE_FAULT].ist = IST_DOUBLE_FAULT;
+    gates[VECTOR_NMI].ist = IST_NMI;
+    gates[VECTOR_MACHINE_CHECK].ist = IST_MACHINE_CHECK;
+    load_interrupts();
+    add_interrupt_handler(VECTOR_WAKEUP, wakeup_action);
+}
+
+void load_interrupts() {
+    auto& local = this_cpu(idt);
+    for (size_t i = 0; i < NUM_VECTORS; ++i) {
+        local[i] = gates[i];
+    }
+    DescriptorPointer idtr = {sizeof(gates) - 1, (uint64_t)local};
+    asm volatile ("lidt %0" :: "m"(idtr));
+}
+
+void add_interrupt_handler(uint8_t vector, InterruptAction& action) {
+    IrqSaveGuard<SpinLock> guard(chain_lock);
+    action.next = nullptr;
+    auto link = &chains[vector];
+    while (*link) {
+        link = &(*link)->next;
+    }
+    __atomic_store_n(link, &action, __ATOMIC_RELEASE);
+}
+
+void remove_interrupt_handler(uint8_t vector, InterruptAction& action) {
+    IrqSaveGuard<SpinLock> guard(chain_lock);
+    for (auto link = &chains[vector]; *link; link = &(*link)->next) {
+        if (*link == &action) {
+            // action.next is left alone for anyone still walking past
+            __atomic_store_n(link, action.next, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+uint8_t alloc_interrupt_vector() {
+    IrqSaveGuard<SpinLock> guard(chain_lock);
+    if (next_vector > VECTOR_DEVICE_LAST) {
+        return 0;
+    }
+    return next_vector++;
+}
+
+static const char* vector_name(unsigned vector) {
+    if (vector < NUM_EXCEPTIONS) {
+        return exception_names[vector];
+    }
+    if (vector == VECTOR_SPURIOUS) {
+        return "spurious";
+    }
+    auto action = __atomic_load_n(&chains[vector], __ATOMIC_ACQUIRE);
+    return action && action->name ? action->name : "unnamed";
+}
+
+static void record_latency(unsigned vector, uint64_t cycles) {
+    auto& stats = this_cpu(vector_stats)[vector];
+    // Bucket 0 is everything under 2^LATENCY_MIN_SHIFT
+    int bucket = 63 - __builtin_clzll(cycles | 1) - LATENCY_MIN_SHIFT + 1;
+    if (bucket < 0) {
+        bucket = 0;
+    } else if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    stats.count++;
+    stats.latency[bucket]++;
+}
+
+void dump_interrupt_stats() {
+    klog("==Interrupts==\n");
+    for (unsigned vector = 0; vector < NUM_VECTORS; ++vector) {
+        VectorStats total = {};
+        for (unsigned cpu = 0; cpu < cpu_count(); ++cpu) {
+            auto& stats = per_cpu(vector_stats, cpu)[vector];
+            total.count += stats.count;
+            for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+                total.latency[i] += stats.latency[i];
+            }
+        }
+        if (!total.count) {
+            continue;
+        }
+        klog(hex(vector, 2), " ", vector_name(vector), ": ", udec(total.count), " taken\n");
+
+        // The histogram, as many buckets to a line as fit
+        LogRecord record;
+        record.write("  cycles");
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            if (!total.latency[i]) {
+                continue;
+            }
+            if (record.length() > LOG_RECORD_MAX - 24) {
+                record.write("\n");
+                Logger::global().commit(record);
+                record = LogRecord();
+                record.write("  cycles");
+            }
+            if (i == LATENCY_BUCKETS - 1) {
+                record.write(" >=2^");
+                record.write(udec(i + LATENCY_MIN_SHIFT - 1));
+            } else {
+                record.write(" <2^");
+                record.write(udec(i + LATENCY_MIN_SHIFT));
+            }
+            record.write(":");
+            record.write(udec(total.latency[i]));
+        }
+        record.write("\n");
+        Logger::global().commit(record);
+    }
+}
+
+static bool handle_page_fault(InterruptFrame* frame) {
+    auto addr = read_cr2();
+    if ((frame->error & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE)) {
+        return PageTable::current().copy_on_write(addr);
+    }
+    // Otherwise only a kernel access to a page that isn't there can be
+    // a demand fault. Anything else is a real bug.
+    if (frame->error & (PF_PRESENT | PF_USER)) {
+        return false;
+    }
+    return DemandPaging::global().handle_fault(addr);
+}
+
+// Logs what we know about an exception nobody could handle, and stops
+// this CPU for good
+[[noreturn]] static void fatal_exception(InterruptFrame* frame) {
+    klog("Unhandled ", exception_names[frame->vector],
+         " (error ", frame->error, ") at ", frame->rip, "\n");
+    if (frame->vector == VECTOR_PAGE_FAULT) {
+        klog("Faulting address: ", read_cr2(), "\n");
+    }
+    klog("rsp ", frame->rsp, " rbp ", frame->rbp, "\n");
+    // Nobody else is going to write the log out. If we interrupted a
+    // drain this won't get anywhere, but then there's nothing we can do.
+    Logger::global().drain();
+    while (true) {
+        disable_interrupts();
+        halt();
+    }
+}
+
+extern "C" void interrupt_dispatch(InterruptFrame* frame) {
+    auto start = rdtsc();
+    auto vector = frame->vector;
+
+    // Every handler on the chain runs: an interrupt line can be shared
+    // by more than one device with something to say
+    bool handled = false;
+    for (auto action = __atomic_load_n(&chains[vector], __ATOMIC_ACQUIRE); action;
+         action = __atomic_load_n(&action->next, __ATOMIC_ACQUIRE)) {
+        handled |= action->handler(frame, action->context);
+    }
+
+    if (vector < NUM_EXCEPTIONS) {
+        if (!handled && !(vector == VECTOR_PAGE_FAULT && handle_page_fault(frame))) {
+            fatal_exception(frame);
+        }
+    } else if (vector >= VECTOR_LEGACY_FIRST && vector <= VECTOR_LEGACY_LAST) {
+        // The PICs are masked, so this can only be one of their
+        // spurious interrupts. They didn't come through the local
+        // APIC, so there's nothing to acknowledge.
+    } else if (vector != VECTOR_SPURIOUS) {
+        // An interrupt nobody asked for isn't worth dying over
+        if (!handled) {
+            klog("Unexpected interrupt ", (uint8_t)vector, "\n");
+        }
+        // The spurious vector is the one that mustn't be acknowledged
+        LocalApic::global().eoi();
+    }
+    record_latency(vector, rdtsc() - start);
+}
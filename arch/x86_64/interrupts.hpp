@@ -0,0 +1,91 @@
+#pragma once
+
+#include "stdint.h"
+
+// Exception vectors we handle specially
+#define VECTOR_NMI 2
+#define VECTOR_DOUBLE_FAULT 8
+#define VECTOR_PAGE_FAULT 14
+#define VECTOR_MACHINE_CHECK 18
+
+// Every vector has a stub in isr.S. The first 32 are the CPU's
+// exceptions. The legacy PICs are remapped to the 16 after that, so
+// anything they raise despite being masked is harmless. Device
+// interrupts get vectors from alloc_interrupt_vector, and the top of
+// the range is kept for IPIs and the local APIC.
+#define NUM_EXCEPTIONS 32
+#define NUM_VECTORS 256
+#define VECTOR_LEGACY_FIRST 0x20
+#define VECTOR_LEGACY_LAST 0x2f
+#define VECTOR_DEVICE_FIRST 0x30
+#define VECTOR_DEVICE_LAST 0xef
+#define VECTOR_TLB_SHOOTDOWN 0xf0
+#define VECTOR_WAKEUP 0xf1
+#define VECTOR_SPURIOUS 0xff
+
+// Page fault error code bits
+#define PF_PRESENT 0x01
+#define PF_WRITE 0x02
+#define PF_USER 0x04
+
+// What isr.S leaves on the stack: the general purpose registers, the
+// vector and error code (zero if the CPU didn't push one), then the
+// CPU's own interrupt frame.
+struct InterruptFrame {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector;
+    uint64_t error;
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+};
+
+// Builds the IDT and loads it on the boot CPU. Until this runs, any
+// exception is a triple fault.
+void init_interrupts();
+
+// Gives the calling CPU its own copy of the IDT and loads it. Handlers
+// are shared, so add_interrupt_handler still covers every CPU.
+void load_interrupts();
+
+// A handler for a vector. Any number of them can share one, and they
+// run in the order they were added. They run with interrupts
+// disabled, and return true if the interrupt was theirs; for an
+// exception, that means it's been dealt with. The local APIC is sent
+// its EOI once every handler has run, so handlers only need to
+// acknowledge their own device.
+typedef bool (*InterruptHandler)(InterruptFrame* frame, void* context);
+struct InterruptAction {
+    InterruptHandler handler;
+    void* context;
+    // For the stats dump
+    const char* name;
+    InterruptAction* next;
+};
+
+// Adds `action` to the end of `vector`'s chain. The action is the
+// caller's, so this never allocates, and it has to stay put until
+// it's removed.
+void add_interrupt_handler(uint8_t vector, InterruptAction& action);
+
+// Takes `action` off `vector`'s chain. Another CPU may still be
+// running it, so it can't be reused straight away.
+void remove_interrupt_handler(uint8_t vector, InterruptAction& action);
+
+// Hands out an unused vector for a device, or 0 if there are none left
+uint8_t alloc_interrupt_vector();
+
+// Every vector counts how many times it was taken on each CPU, and
+// keeps a histogram of the cycles from entering the dispatcher to
+// sending the EOI (or returning, for exceptions). Bucket i counts
+// latencies under 2^(i + LATENCY_MIN_SHIFT) cycles, and the last
+// bucket takes everything longer.
+#define LATENCY_BUCKETS 16
+#define LATENCY_MIN_SHIFT 7
+
+// Logs the counts and histograms, summed over every CPU, for each
+// vector that has been taken
+void dump_interrupt_stats();
@@ -1,7 +1,21 @@
 #pragma once
 
-// The heap starts just above the recursive mappings.
+// Everything from here up is the kernel's, and shared by every
+// address space
+#define KERNEL_HALF_START 0xffff800000000000
+
+// The heap starts just above the recursive mappings, and gets a
+// 512GB slot of its own to grow into.
 #define KERNEL_HEAP_START 0xffff810000000000
+#define KERNEL_HEAP_END 0xffff818000000000
+// The page database is reserved right after the heap, and only backed
+// where there's memory to describe.
+#define PAGE_DATABASE_START 0xffff818000000000
+#define PAGE_DATABASE_END 0xffff820000000000
+// Everything from there up to the direct map is handed out in ranges
+// by the VirtualAllocator: stacks, device windows, big buffers.
+#define KERNEL_VMALLOC_START 0xffff820000000000
+#define KERNEL_VMALLOC_END 0xffffc00000000000
 // The stack eventually starts at the other end of kernel memory space,
 // just below the kernel's 2GB code region
 #define KERNEL_STACK_TOP 0xffffffff80000000
@@ -16,14 +30,23 @@
 // Unused 32-bit user code segment at 0x18
 #define USER_CODE_SEGMENT 0x20
 #define USER_DATA_SEGMENT 0x28
-#define CORE0_STATE_SEGMENT 0x30
+// Every CPU has a GDT of its own, with its own TSS in this slot
+#define CPU_STATE_SEGMENT 0x30
 
 // The two recursive mapping areas. On x86_64, these are the two
 // lowest 512GB chunks of the high-half of the virtual memory space.
 #define RECURSIVE_MAPPING_INDEX 0x100
 #define FORK_MAPPING_INDEX 0x101
-#define RECURSIVE_MAPPING 0xFFFF000000000000 | (RECURSIVE_MAPPING_INDEX << 39)
-#define FORK_MAPPING 0xFFFF000000000000 | (FORK_MAPPING_INDEX << 39)
+#define RECURSIVE_MAPPING (0xFFFF000000000000 | (RECURSIVE_MAPPING_INDEX * 0x8000000000))
+#define FORK_MAPPING (0xFFFF000000000000 | (FORK_MAPPING_INDEX * 0x8000000000))
+
+// All of physical memory is mapped here once the kernel has read the
+// memory map. The 64TB region is the upper quarter of the high half.
+#define PHYSICAL_MAPPING 0xffffc00000000000
+#define PHYSICAL_MAPPING_SIZE 0x0000400000000000
+// Until then, physical memory is reached through the identity map
+// set up by tables.S, which covers this much.
+#define BOOT_IDENTITY_SIZE 0x40000000
 
 #define HUGE_PAGE_SIZE 0x40000000
 #define HUGE_PAGE_MASK 0x3fffffff
@@ -31,6 +54,16 @@
 #define BIG_PAGE_MASK 0x1fffff
 #define PAGE_SIZE 0x1000
 #define PAGE_MASK 0x0fff
+#define PAGE_SHIFT 12
+
+// Low memory the application processor trampoline is copied to, with
+// the page tables it runs on right after it. Startup IPIs can only
+// point below 1MB, at a page boundary.
+#define SMP_TRAMPOLINE 0x8000
+#define SMP_TRAMPOLINE_PML4 (SMP_TRAMPOLINE + 0x1000)
+#define SMP_TRAMPOLINE_PDP (SMP_TRAMPOLINE + 0x2000)
+#define SMP_TRAMPOLINE_PD (SMP_TRAMPOLINE + 0x3000)
+#define SMP_TRAMPOLINE_SIZE 0x4000
 
 // 16-byte alignment is nice and clean :)
 #define ALLOC_ALIGN 0x10
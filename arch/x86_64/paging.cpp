@@ -1 +1,650 @@
 #include "paging.hpp"
+#include "kmemlayout.h"
+#include "cpu.hpp"
+#include "logging.hpp"
+#include "page_allocator.hpp"
+#include "page.hpp"
+#include "tlb.hpp"
+
+uintptr_t PhysicalWindow::base = 0;
+size_t PhysicalWindow::size = BOOT_IDENTITY_SIZE;
+
+// With the PML4 pointing at itself from RECURSIVE_MAPPING_INDEX, each
+// level of the active table is visible at a fixed virtual
+// address. Going up a level is just another trip through the
+// recursive slot.
+static constexpr uintptr_t RECURSIVE_SLOT = RECURSIVE_MAPPING_INDEX;
+static constexpr uintptr_t PT_BASE = RECURSIVE_MAPPING;
+static constexpr uintptr_t PD_BASE = PT_BASE + (RECURSIVE_SLOT << 30);
+static constexpr uintptr_t PDP_BASE = PD_BASE + (RECURSIVE_SLOT << 21);
+static constexpr uintptr_t PML4_BASE = PDP_BASE + (RECURSIVE_SLOT << 12);
+
+static uint64_t* pml4_entry(uintptr_t virt) {
+    return (uint64_t*)PML4_BASE + ((virt >> 39) & 0x1ff);
+}
+
+static uint64_t* pdp_entry(uintptr_t virt) {
+    return (uint64_t*)PDP_BASE + ((virt >> 30) & 0x3ffff);
+}
+
+static uint64_t* pd_entry(uintptr_t virt) {
+    return (uint64_t*)PD_BASE + ((virt >> 21) & 0x7ffffff);
+}
+
+static uint64_t* pt_entry(uintptr_t virt) {
+    return (uint64_t*)PT_BASE + ((virt >> 12) & 0xfffffffff);
+}
+
+// The same trick through FORK_MAPPING_INDEX shows the levels of
+// whichever table is attached there, since every table has its own
+// recursive slot. That lets us walk a table other than the active one.
+static constexpr uintptr_t FORK_PT_BASE = FORK_MAPPING;
+static constexpr uintptr_t FORK_PD_BASE = FORK_PT_BASE + (RECURSIVE_SLOT << 30);
+static constexpr uintptr_t FORK_PDP_BASE = FORK_PD_BASE + (RECURSIVE_SLOT << 21);
+static constexpr uintptr_t FORK_PML4_BASE = FORK_PDP_BASE + (RECURSIVE_SLOT << 12);
+
+// The entry at `level` (4 for the PML4, 1 for a page table) that maps
+// `virt` in the attached table
+static uint64_t* fork_entry(uintptr_t virt, unsigned level) {
+    switch (level) {
+    case 4:
+        return (uint64_t*)FORK_PML4_BASE + ((virt >> 39) & 0x1ff);
+    case 3:
+        return (uint64_t*)FORK_PDP_BASE + ((virt >> 30) & 0x3ffff);
+    case 2:
+        return (uint64_t*)FORK_PD_BASE + ((virt >> 21) & 0x7ffffff);
+    default:
+        return (uint64_t*)FORK_PT_BASE + ((virt >> 12) & 0xfffffffff);
+    }
+}
+
+// Bytes mapped by one entry at `level`
+static size_t level_span(unsigned level) {
+    return (size_t)PAGE_SIZE << (9 * (level - 1));
+}
+
+// Points the fork slot of the active table at `pml4`, or clears it.
+// Changing a PML4 entry can leave stale translations anywhere below
+// it, so this flushes the whole TLB.
+static void attach(uintptr_t pml4) {
+    *pml4_entry(FORK_MAPPING) = pml4 ? pml4 | PTE_PRESENT | PTE_WRITE : 0;
+    write_cr3(read_cr3());
+}
+
+// Makes sure `entry` points at a lower-level table, allocating an
+// empty one if needed. `next` is any entry in that lower table.
+static bool ensure_table(uint64_t* entry, uint64_t* next) {
+    if (*entry & PTE_PRESENT) {
+        if (*entry & PTE_LARGE) {
+            klog("Tried to map over a large page\n");
+            return false;
+        }
+        return true;
+    }
+    auto frame = PageAllocator::global().alloc_zeroed();
+    if (!frame) {
+        return false;
+    }
+    if (auto page = phys_to_page(frame)) {
+        page->owner = PageOwner::PageTable;
+    }
+    *entry = frame | PTE_PRESENT | PTE_WRITE;
+
+    invlpg((uintptr_t)next & ~PAGE_MASK);
+    return true;
+}
+
+bool PageTable::fill_kernel_half() {
+    for (uintptr_t i = 256; i < 512; ++i) {
+        if (i == RECURSIVE_MAPPING_INDEX || i == FORK_MAPPING_INDEX) {
+            continue;
+        }
+        auto virt = 0xffff000000000000 | (i << 39);
+        if (!ensure_table(pml4_entry(virt), pdp_entry(virt))) {
+            klog("Ran out of memory filling in the kernel half\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+PageTable PageTable::current() {
+    PageTable table;
+    table.pml4 = read_cr3() & PTE_ADDR_MASK;
+    return table;
+}
+
+// Whether a page of `page_size` bytes can map `phys` at `virt`, with
+// `remaining` bytes left to map.
+static bool fits(uintptr_t phys, uintptr_t virt, size_t remaining, size_t page_size) {
+    return ((phys | virt) & (page_size - 1)) == 0 && remaining >= page_size;
+}
+
+// Whether a range from `virt` to `end` covers the whole page of
+// `page_size` bytes starting at `virt`.
+static bool covers(uintptr_t virt, uintptr_t end, size_t page_size) {
+    return (virt & (page_size - 1)) == 0 && end - virt >= page_size;
+}
+
+// Replaces a large page mapping of `size` bytes with a table of 512
+// smaller mappings covering the same memory, so that part of it can be
+// changed. `next` is any entry in the new table.
+static bool split_large(uint64_t* entry, uint64_t* next, size_t size) {
+    auto frame = PageAllocator::global().alloc_order(0);
+    if (!frame) {
+        return false;
+    }
+    if (auto page = phys_to_page(frame)) {
+        page->owner = PageOwner::PageTable;
+    }
+
+    auto old = *entry;
+    auto base = old & PTE_ADDR_MASK & ~(size - 1);
+    auto flags = old & ~PTE_ADDR_MASK;
+    auto child_size = size / 512;
+    // The PAT bit of a large page sits in the address field, and moves
+    // to where PTE_LARGE was in a 4KB entry.
+    if (child_size == PAGE_SIZE) {
+        flags &= ~PTE_LARGE;
+        if (old & PTE_PAT_LARGE) {
+            flags |= PTE_PAT;
+        }
+    } else {
+        flags |= old & PTE_PAT_LARGE;
+    }
+
+    // The new table is filled in before it goes live, so the memory
+    // stays mapped throughout.
+    auto entries = phys_to_virt<uint64_t>(frame);
+    for (size_t i = 0; i < 512; ++i) {
+        entries[i] = (base + i * child_size) | flags;
+    }
+    *entry = frame | (old & (PTE_PRESENT | PTE_WRITE | PTE_USER));
+    invlpg((uintptr_t)next & ~PAGE_MASK);
+    return true;
+}
+
+// Memory type encodings for the PAT MSR
+#define PAT_UC 0x00
+#define PAT_WC 0x01
+#define PAT_WT 0x04
+#define PAT_WB 0x06
+#define PAT_UC_MINUS 0x07
+
+#define MSR_PAT 0x277
+
+// The first four entries are the power-on defaults, so entries without
+// the PAT bit mean the same with or without PAT support. Entry 4 is
+// write-combining instead of a second write-back.
+static constexpr uint64_t pat_entries[8] = {
+    PAT_WB, PAT_WT, PAT_UC_MINUS, PAT_UC,
+    PAT_WC, PAT_WT, PAT_UC_MINUS, PAT_UC,
+};
+
+void PageTable::init_memory_types() {
+    if (!CpuFeatures::global().pat) {
+        klog("No PAT, write-combining mappings will be uncached\n");
+        return;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        value |= pat_entries[i] << (i * 8);
+    }
+    // Nothing maps anything with entry 4 yet, so there are no cache
+    // lines or TLB entries of the old type to worry about beyond a
+    // flush.
+    write_msr(MSR_PAT, value);
+    Tlb::flush_all();
+}
+
+// PAT/PCD/PWT bits selecting the entry of `pat_entries` for `type`.
+// Large pages have their PAT bit somewhere else.
+static uint64_t memory_type_bits(MemoryType type, bool large) {
+    auto pat = large ? PTE_PAT_LARGE : PTE_PAT;
+    switch (type) {
+    case MemoryType::WriteBack:
+        return 0;
+    case MemoryType::WriteThrough:
+        return PTE_PWT;
+    case MemoryType::UncachedMinus:
+        return PTE_PCD;
+    case MemoryType::Uncached:
+        return PTE_PCD | PTE_PWT;
+    case MemoryType::WriteCombining:
+        return CpuFeatures::global().pat ? pat : PTE_PCD;
+    }
+    return PTE_PCD | PTE_PWT;
+}
+
+bool PageTable::map(uintptr_t phys, uintptr_t virt, size_t size, MemoryType type) {
+    bool huge_pages = CpuFeatures::global().huge_pages;
+    // The kernel half is the same in every address space, so its
+    // entries can survive address space switches.
+    uint64_t flags = PTE_PRESENT | PTE_WRITE;
+    if (virt >= KERNEL_HALF_START) {
+        flags |= PTE_GLOBAL;
+    }
+    auto small_flags = flags | memory_type_bits(type, false);
+    auto large_flags = flags | memory_type_bits(type, true) | PTE_LARGE;
+
+    // Each step uses the biggest page that the alignment of both
+    // addresses and the remaining size allow, so only the unaligned
+    // edges of a range end up with 4KB pages. We only put a large page
+    // where there isn't already a lower-level table.
+    size_t offset = 0;
+    while (offset < size) {
+        auto addr = virt + offset;
+        auto frame = phys + offset;
+        auto remaining = size - offset;
+
+        if (!ensure_table(pml4_entry(addr), pdp_entry(addr))) {
+            return false;
+        }
+
+        auto pdpe = pdp_entry(addr);
+        if (huge_pages && fits(frame, addr, remaining, HUGE_PAGE_SIZE) &&
+            (!(*pdpe & PTE_PRESENT) || (*pdpe & PTE_LARGE))) {
+            *pdpe = frame | large_flags;
+            invlpg(addr);
+            offset += HUGE_PAGE_SIZE;
+            continue;
+        }
+        // Mapping part of an existing huge page means breaking it up
+        if ((*pdpe & PTE_PRESENT) && (*pdpe & PTE_LARGE) &&
+            !split_large(pdpe, pd_entry(addr), HUGE_PAGE_SIZE)) {
+            return false;
+        }
+        if (!ensure_table(pdpe, pd_entry(addr))) {
+            return false;
+        }
+
+        auto pde = pd_entry(addr);
+        if (fits(frame, addr, remaining, BIG_PAGE_SIZE) &&
+            (!(*pde & PTE_PRESENT) || (*pde & PTE_LARGE))) {
+            *pde = frame | large_flags;
+            invlpg(addr);
+            offset += BIG_PAGE_SIZE;
+            continue;
+        }
+        if ((*pde & PTE_PRESENT) && (*pde & PTE_LARGE) &&
+            !split_large(pde, pt_entry(addr), BIG_PAGE_SIZE)) {
+            return false;
+        }
+        if (!ensure_table(pde, pt_entry(addr))) {
+            return false;
+        }
+
+        *pt_entry(addr) = frame | small_flags;
+        invlpg(addr);
+        offset += PAGE_SIZE;
+    }
+    return true;
+}
+
+bool PageTable::map_frames(const uintptr_t* frames, size_t count, uintptr_t virt,
+                           MemoryType type) {
+    size_t i = 0;
+    while (i < count) {
+        auto run = i + 1;
+        while (run < count && frames[run] == frames[run - 1] + PAGE_SIZE) {
+            run++;
+        }
+        if (!map(frames[i], virt + i * PAGE_SIZE, (run - i) * PAGE_SIZE, type)) {
+            unmap(virt, i * PAGE_SIZE);
+            return false;
+        }
+        i = run;
+    }
+    return true;
+}
+
+void PageTable::unmap(uintptr_t virt, size_t size) {
+    auto end = virt + size;
+    auto addr = virt;
+    TlbBatch batch;
+
+    // Skip whole unmapped stretches a level at a time.
+    auto skip = [&](size_t span) {
+        auto next = (addr + span) & ~(span - 1);
+        addr = next > addr ? next : end;
+    };
+
+    while (addr < end) {
+        if (!(*pml4_entry(addr) & PTE_PRESENT)) {
+            skip(512ul * HUGE_PAGE_SIZE);
+            continue;
+        }
+
+        auto pdpe = pdp_entry(addr);
+        if (!(*pdpe & PTE_PRESENT)) {
+            skip(HUGE_PAGE_SIZE);
+            continue;
+        }
+        if (*pdpe & PTE_LARGE) {
+            if (covers(addr, end, HUGE_PAGE_SIZE)) {
+                *pdpe = 0;
+                batch.add(addr);
+                addr += HUGE_PAGE_SIZE;
+                continue;
+            }
+            if (!split_large(pdpe, pd_entry(addr), HUGE_PAGE_SIZE)) {
+                klog("Out of memory splitting a huge page at ", addr, "\n");
+                return;
+            }
+        }
+
+        auto pde = pd_entry(addr);
+        if (!(*pde & PTE_PRESENT)) {
+            skip(BIG_PAGE_SIZE);
+            continue;
+        }
+        if (*pde & PTE_LARGE) {
+            if (covers(addr, end, BIG_PAGE_SIZE)) {
+                *pde = 0;
+                batch.add(addr);
+                addr += BIG_PAGE_SIZE;
+                continue;
+            }
+            if (!split_large(pde, pt_entry(addr), BIG_PAGE_SIZE)) {
+                klog("Out of memory splitting a big page at ", addr, "\n");
+                return;
+            }
+        }
+
+        *pt_entry(addr) = 0;
+        batch.add(addr);
+        addr += PAGE_SIZE;
+    }
+}
+
+uintptr_t PageTable::physical(uintptr_t virt) {
+    if (!(*pml4_entry(virt) & PTE_PRESENT)) {
+        return 0;
+    }
+    auto pdpe = *pdp_entry(virt);
+    if (!(pdpe & PTE_PRESENT)) {
+        return 0;
+    }
+    if (pdpe & PTE_LARGE) {
+        return (pdpe & PTE_ADDR_MASK & ~HUGE_PAGE_MASK) + (virt & HUGE_PAGE_MASK);
+    }
+    auto pde = *pd_entry(virt);
+    if (!(pde & PTE_PRESENT)) {
+        return 0;
+    }
+    if (pde & PTE_LARGE) {
+        return (pde & PTE_ADDR_MASK & ~BIG_PAGE_MASK) + (virt & BIG_PAGE_MASK);
+    }
+    auto pte = *pt_entry(virt);
+    if (!(pte & PTE_PRESENT)) {
+        return 0;
+    }
+    return (pte & PTE_ADDR_MASK) + (virt & PAGE_MASK);
+}
+
+static uintptr_t alloc_table() {
+    auto frame = PageAllocator::global().alloc_zeroed();
+    if (!frame) {
+        return 0;
+    }
+    if (auto page = phys_to_page(frame)) {
+        page->owner = PageOwner::PageTable;
+    }
+    return frame;
+}
+
+// Copies the level-`level` table that maps `virt` in the attached table
+// into `dest`. Leaf frames are shared, and writable ones are made
+// copy-on-write on both sides, which sets `protected_any`.
+static bool clone_table(uintptr_t virt, unsigned level, uint64_t* dest, bool& protected_any) {
+    auto& pages = PageAllocator::global();
+    auto span = level_span(level);
+    for (size_t i = 0; i < 512; ++i) {
+        auto addr = virt + i * span;
+        auto src = fork_entry(addr, level);
+        auto entry = *src;
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+
+        if (level == 1 || (entry & PTE_LARGE)) {
+            // Frames we don't manage (device memory, say) are shared
+            // as they are.
+            auto frame = entry & PTE_ADDR_MASK & ~(span - 1);
+            auto page = phys_to_page(frame);
+            if (page && !(page->flags & PAGE_RESERVED)) {
+                if (entry & PTE_WRITE) {
+                    entry = (entry & ~PTE_WRITE) | PTE_COW;
+                    *src = entry;
+                    protected_any = true;
+                }
+                pages.share(frame);
+            }
+            dest[i] = entry;
+            continue;
+        }
+
+        auto child = alloc_table();
+        if (!child) {
+            return false;
+        }
+        dest[i] = child | (entry & (PTE_PRESENT | PTE_WRITE | PTE_USER));
+        if (!clone_table(addr, level - 1, phys_to_virt<uint64_t>(child), protected_any)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drops the references held by the level-`level` table that maps
+// `virt` in the attached table, and frees the tables below it.
+static void destroy_table(uintptr_t virt, unsigned level) {
+    auto& pages = PageAllocator::global();
+    auto span = level_span(level);
+    for (size_t i = 0; i < 512; ++i) {
+        auto addr = virt + i * span;
+        auto entry = *fork_entry(addr, level);
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+        if (level == 1 || (entry & PTE_LARGE)) {
+            pages.release(entry & PTE_ADDR_MASK & ~(span - 1), PageAllocator::order_for(span));
+            continue;
+        }
+        destroy_table(addr, level - 1);
+        pages.free(entry & PTE_ADDR_MASK, 0);
+    }
+}
+
+PageTable PageTable::clone() const {
+    PageTable copy;
+    copy.pml4 = alloc_table();
+    if (!copy.pml4) {
+        return copy;
+    }
+
+    // Only the lower half is walked. The kernel half is the same in
+    // every address space, so its top-level entries are just copied.
+    attach(pml4);
+    auto dest = phys_to_virt<uint64_t>(copy.pml4);
+    auto source = (uint64_t*)FORK_PML4_BASE;
+    bool ok = true;
+    bool protected_any = false;
+    for (size_t i = 0; i < 512 && ok; ++i) {
+        auto entry = source[i];
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+        if (i >= 256) {
+            dest[i] = entry;
+            continue;
+        }
+        auto child = alloc_table();
+        if (!child) {
+            ok = false;
+            break;
+        }
+        dest[i] = child | (entry & (PTE_PRESENT | PTE_WRITE | PTE_USER));
+        ok = clone_table(i * level_span(4), 3, phys_to_virt<uint64_t>(child), protected_any);
+    }
+    dest[RECURSIVE_MAPPING_INDEX] = copy.pml4 | PTE_PRESENT | PTE_WRITE;
+    dest[FORK_MAPPING_INDEX] = 0;
+    // Detaching flushes the active table. If we were cloning another
+    // one, whatever is tagged for it has gone stale.
+    attach(0);
+    Tlb::forget(pml4);
+    // Another CPU running the table could otherwise keep writing
+    // through stale writable entries into frames the copy now shares.
+    // Which CPUs have it loaded isn't tracked, so they all flush.
+    if (protected_any && Tlb::shootdown) {
+        Tlb::shootdown(pml4, nullptr, 0);
+    }
+
+    if (!ok) {
+        klog("Ran out of memory cloning an address space\n");
+        copy.destroy();
+        copy.pml4 = 0;
+    }
+    return copy;
+}
+
+void PageTable::destroy() {
+    if (pml4 == (read_cr3() & PTE_ADDR_MASK)) {
+        klog("Can't destroy the active page table\n");
+        return;
+    }
+    attach(pml4);
+    auto& pages = PageAllocator::global();
+    auto entries = (uint64_t*)FORK_PML4_BASE;
+    for (size_t i = 0; i < 256; ++i) {
+        if (entries[i] & PTE_PRESENT) {
+            destroy_table(i * level_span(4), 3);
+            pages.free(entries[i] & PTE_ADDR_MASK, 0);
+        }
+    }
+    attach(0);
+    Tlb::forget(pml4);
+    pages.free(pml4, 0);
+    pml4 = 0;
+}
+
+bool PageTable::copy_on_write(uintptr_t virt) {
+    if (!(*pml4_entry(virt) & PTE_PRESENT)) {
+        return false;
+    }
+    auto entry = pdp_entry(virt);
+    size_t size = HUGE_PAGE_SIZE;
+    if ((*entry & PTE_PRESENT) && !(*entry & PTE_LARGE)) {
+        entry = pd_entry(virt);
+        size = BIG_PAGE_SIZE;
+        if ((*entry & PTE_PRESENT) && !(*entry & PTE_LARGE)) {
+            entry = pt_entry(virt);
+            size = PAGE_SIZE;
+        }
+    }
+    if ((*entry & (PTE_PRESENT | PTE_COW)) != (PTE_PRESENT | PTE_COW)) {
+        return false;
+    }
+
+    auto& pages = PageAllocator::global();
+    auto frame = *entry & PTE_ADDR_MASK & ~(size - 1);
+    // The low bits of a large page's address field hold its PAT bit
+    auto flags = (*entry & ~(PTE_ADDR_MASK & ~(size - 1)) & ~PTE_COW) | PTE_WRITE;
+    auto page = phys_to_page(frame);
+    if (page && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) == 1) {
+        // Everyone else has already made their own copy, so this one
+        // is ours.
+        *entry = frame | flags;
+    } else {
+        auto order = PageAllocator::order_for(size);
+        auto copy = pages.alloc_order(order);
+        if (!copy) {
+            return false;
+        }
+        for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+            copy_page(phys_to_virt(copy + offset), phys_to_virt(frame + offset));
+        }
+        *entry = copy | flags;
+        pages.release(frame, order);
+    }
+    invlpg(virt & ~(size - 1));
+    return true;
+}
+
+namespace {
+    // The range relocate is moving tables out of. A table with more
+    // than one parent gets a copy for each of them: the boot tables
+    // share their low page directory between the identity map and the
+    // kernel mapping, and the identity map is about to be unmapped
+    // without taking the kernel with it.
+    struct Relocations {
+        uintptr_t start;
+        uintptr_t end;
+        bool failed;
+    };
+}
+
+static uintptr_t relocate_table(uintptr_t table, unsigned level, Relocations& relocations) {
+    if (table >= relocations.start && table < relocations.end) {
+        auto copy = PageAllocator::global().alloc_order(0);
+        if (!copy) {
+            relocations.failed = true;
+            return table;
+        }
+        if (auto page = phys_to_page(copy)) {
+            page->owner = PageOwner::PageTable;
+        }
+        auto from = phys_to_virt<uint64_t>(table);
+        auto to = phys_to_virt<uint64_t>(copy);
+        for (size_t i = 0; i < 512; ++i) {
+            to[i] = from[i];
+        }
+        table = copy;
+    }
+
+    if (level == 1) {
+        return table;
+    }
+    auto entries = phys_to_virt<uint64_t>(table);
+    for (size_t i = 0; i < 512; ++i) {
+        if (level == 4 && (i == RECURSIVE_MAPPING_INDEX || i == FORK_MAPPING_INDEX)) {
+            continue;
+        }
+        auto entry = entries[i];
+        if (!(entry & PTE_PRESENT) || (entry & PTE_LARGE)) {
+            continue;
+        }
+        auto child = relocate_table(entry & PTE_ADDR_MASK, level - 1, relocations);
+        entries[i] = (entry & ~PTE_ADDR_MASK) | child;
+    }
+    return table;
+}
+
+bool PageTable::relocate(uintptr_t start, uintptr_t end) {
+    Relocations relocations;
+    relocations.start = start;
+    relocations.end = end;
+    relocations.failed = false;
+
+    // The copies are built alongside the live tables, so nothing
+    // changes for the CPU until we load the new PML4. Table entries
+    // outside the range are updated in place, but only ever to point
+    // at identical copies.
+    auto old = current().pml4;
+    auto pml4 = relocate_table(old, 4, relocations);
+    if (relocations.failed) {
+        klog("Ran out of memory relocating page tables\n");
+        return false;
+    }
+    phys_to_virt<uint64_t>(pml4)[RECURSIVE_MAPPING_INDEX] = pml4 | PTE_PRESENT | PTE_WRITE;
+
+    PageTable table;
+    table.pml4 = pml4;
+    table.activate();
+    Tlb::forget(old);
+    return true;
+}
+
+void PageTable::activate() {
+    Tlb::switch_to(pml4);
+}
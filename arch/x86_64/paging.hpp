@@ -2,17 +2,121 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "kmemlayout.h"
 
+// Page table entry bits
+#define PTE_PRESENT 0x001
+#define PTE_WRITE 0x002
+#define PTE_USER 0x004
+#define PTE_PWT 0x008
+#define PTE_PCD 0x010
+#define PTE_LARGE 0x080
+// In 4KB entries, the PAT bit is where PTE_LARGE is in the others
+#define PTE_PAT 0x080
+#define PTE_GLOBAL 0x100
+#define PTE_PAT_LARGE 0x1000
+// Available to software: a read-only mapping of a frame shared by
+// clone(), to be copied on the first write
+#define PTE_COW 0x200
+#define PTE_ADDR_MASK 0x000ffffffffff000
+
+// Physical memory is reached through a linear window. During early
+// boot that's the identity map of the first BOOT_IDENTITY_SIZE bytes;
+// once the direct map is built it's PHYSICAL_MAPPING.
+namespace PhysicalWindow {
+    extern uintptr_t base;
+    extern size_t size;
+}
+
+// Returns a pointer through which physical memory at `phys` can be
+// accessed. Only valid below PhysicalWindow::size.
+template <typename T = void>
+inline T* phys_to_virt(uintptr_t phys) {
+    return (T*)(phys + PhysicalWindow::base);
+}
+
+// The reverse of phys_to_virt, for pointers into the physical window
+inline uintptr_t virt_to_phys(const void* virt) {
+    return (uintptr_t)virt - PhysicalWindow::base;
+}
+
+// Cache behaviour of a mapping. Anything other than WriteBack is for
+// device memory: MMIO registers want Uncached, and buffers the CPU
+// only writes to (framebuffers, descriptor rings) want
+// WriteCombining.
+enum class MemoryType {
+    WriteBack,
+    WriteThrough,
+    WriteCombining,
+    // Uncached, but can be overridden by the MTRRs
+    UncachedMinus,
+    Uncached,
+};
+
+// Page table manipulation goes through the recursive mapping, so
+// map/unmap/physical only work on the currently active table.
 class PageTable {
     uintptr_t pml4;
 
 public:
-    PageTable create();
-    PageTable current();
+    // Programs the PAT so every MemoryType has an entry. Each CPU needs
+    // to do this before using mappings other than WriteBack.
+    static void init_memory_types();
+
+    static PageTable create();
+    static PageTable current();
 
-    void map(uintptr_t phys, uintptr_t virt, size_t size);
+    // Copies every table of the active hierarchy that lives in the
+    // physical range [start, end) somewhere else, and switches to the
+    // result. This is how we move off the boot tables before their
+    // memory is reclaimed. Tables shared between parents come out
+    // unshared. Returns false (leaving the active table alone) if it
+    // runs out of memory.
+    static bool relocate(uintptr_t start, uintptr_t end);
+
+    // Gives every kernel-half slot of the active PML4 a table, so those
+    // entries never change again and clone() can copy them once. Has
+    // to run before the first clone(). Returns false if it runs out of
+    // memory.
+    static bool fill_kernel_half();
+
+    // Makes a new address space sharing this one's memory. The kernel
+    // half is shared outright, through the tables fill_kernel_half
+    // put in place. Frames in the lower half are shared
+    // read-only and copied on the first write from either side, so
+    // this costs a copy of the lower half's tables rather than of the
+    // memory they map. Returns a table with physical() == 0 if it runs
+    // out of memory. Other CPUs are sent a shootdown if any entries
+    // were write-protected, since this table may be active on them.
+    PageTable clone() const;
+
+    // Frees the lower half of a table, and the table itself, dropping
+    // a reference to every frame it maps. Must not be the active
+    // table.
+    void destroy();
+
+    // Handles a write fault at `virt` in the active table. Returns
+    // false if the page there isn't copy-on-write, or we're out of
+    // memory.
+    bool copy_on_write(uintptr_t virt);
+
+    bool map(uintptr_t phys, uintptr_t virt, size_t size,
+             MemoryType type = MemoryType::WriteBack);
+    // Maps `count` frames, which needn't be contiguous, one after the
+    // other from `virt`. Physically contiguous runs still get large
+    // pages where they line up.
+    bool map_frames(const uintptr_t* frames, size_t count, uintptr_t virt,
+                    MemoryType type = MemoryType::WriteBack);
     void unmap(uintptr_t virt, size_t size);
     uintptr_t physical(uintptr_t virt);
+    uintptr_t physical() const { return pml4; }
 
+    // Switches to this table. With PCIDs, this doesn't flush the TLB
+    // if the table was used recently.
     void activate();
 };
+
+// Clones the active table, maps a page in a part of the kernel half
+// nothing has touched yet, and checks the clone can read it. Logs
+// whether it passed. kmain runs it for `pagecheck` on the command line.
+void check_clone_kernel_half();
@@ -0,0 +1,45 @@
+#include "paging.hpp"
+#include "logging.hpp"
+#include "page_allocator.hpp"
+#include "virtual_allocator.hpp"
+
+// Bytes covered by one PML4 entry. Aligning to this puts the test page
+// in a slot of its own.
+#define PML4_SPAN ((size_t)1 << 39)
+
+#define CHECK_PATTERN 0x5a5a12345678a5a5
+
+void check_clone_kernel_half() {
+    auto original = PageTable::current();
+    auto copy = original.clone();
+    if (!copy.physical()) {
+        klog("pagecheck: out of memory for the clone\n");
+        return;
+    }
+
+    // Mapped after the clone, so the clone only sees it if the kernel
+    // half really is shared
+    auto frame = PageAllocator::global().alloc_order(0);
+    auto virt = VirtualAllocator::global().alloc(PAGE_SIZE, PML4_SPAN);
+    if (!frame || !virt || !original.map(frame, virt, PAGE_SIZE)) {
+        klog("pagecheck: couldn't map the test page\n");
+    } else {
+        *phys_to_virt<uint64_t>(frame) = CHECK_PATTERN;
+        copy.activate();
+        auto seen = *(volatile uint64_t*)virt;
+        original.activate();
+        if (seen == CHECK_PATTERN) {
+            klog("pagecheck: passed\n");
+        } else {
+            klog("pagecheck: FAILED, the clone read ", seen, " at ", virt, "\n");
+        }
+    }
+
+    if (virt) {
+        VirtualAllocator::global().free(virt);
+    }
+    if (frame) {
+        PageAllocator::global().free(frame, 0);
+    }
+    copy.destroy();
+}
@@ -0,0 +1,66 @@
+#include "percpu.hpp"
+#include "cpu.hpp"
+#include "kmemlayout.h"
+#include "paging.hpp"
+#include "page_allocator.hpp"
+
+#define MSR_GS_BASE 0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
+
+// From the linker script: the bounds of .percpu as linked (from 0),
+// where its initial contents are in the kernel image, and room in
+// .bss for the boot CPU's copy
+extern "C" char percpu_start[];
+extern "C" char percpu_end[];
+extern "C" const char percpu_image[];
+extern "C" char percpu_boot[];
+
+PER_CPU uintptr_t percpu_self;
+
+static uintptr_t bases[MAX_CPUS];
+
+uintptr_t percpu_base(unsigned cpu) {
+    return bases[cpu];
+}
+
+uintptr_t percpu_image_phys() {
+    return (uintptr_t)percpu_image - KERNEL_VMA_BASE;
+}
+
+size_t percpu_size() {
+    return percpu_end - percpu_start;
+}
+
+// Copies are always made from the image, never from a CPU that's
+// already running, so every CPU starts from the same state.
+static void copy_image(unsigned cpu, uintptr_t base) {
+    copy_forward((void*)base, percpu_image, percpu_size());
+    *(uintptr_t*)(base + (uintptr_t)&percpu_self) = base;
+    bases[cpu] = base;
+}
+
+void init_boot_percpu() {
+    copy_image(0, (uintptr_t)percpu_boot);
+    load_percpu(0);
+}
+
+bool alloc_percpu(unsigned cpu) {
+    if (bases[cpu]) {
+        copy_image(cpu, bases[cpu]);
+        return true;
+    }
+    auto phys = PageAllocator::global().alloc(percpu_size());
+    if (!phys) {
+        return false;
+    }
+    copy_image(cpu, (uintptr_t)phys_to_virt(phys));
+    return true;
+}
+
+void load_percpu(unsigned cpu) {
+    write_msr(MSR_GS_BASE, bases[cpu]);
+    // Nothing runs in user mode yet, so there's no user GS base for
+    // swapgs to trade places with. Keeping both the same means a
+    // swapgs changes nothing.
+    write_msr(MSR_KERNEL_GS_BASE, bases[cpu]);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+// Per-CPU variables. Anything declared PER_CPU goes in the .percpu
+// section, which is linked at address 0 and copied once for each CPU.
+// Each CPU's GS base points at its own copy, so a variable's address
+// is its offset in there, and %gs:var is this CPU's copy of it.
+//
+//     static PER_CPU uint64_t faults;
+//     this_cpu_write(faults, this_cpu_read(faults) + 1);
+//     this_cpu(faults)++;
+//
+// The copies are made from the linked image, before any code runs on
+// the CPU, so PER_CPU variables must be constant-initialized: there's
+// nowhere for a constructor to run. Only ever use them through the
+// accessors below; the variable itself isn't at a usable address.
+#define PER_CPU __attribute__((section(".percpu")))
+
+// Reads the calling CPU's copy of a scalar PER_CPU variable with a
+// single %gs-relative load
+#define this_cpu_read(var) ({                                           \
+        decltype(var) this_cpu_value;                                   \
+        asm volatile ("mov %%gs:%P1, %0"                                \
+                      : "=r"(this_cpu_value) : "i"(&(var)) : "memory"); \
+        this_cpu_value; })
+
+// Writes the calling CPU's copy of a scalar PER_CPU variable with a
+// single %gs-relative store
+#define this_cpu_write(var, value) do {                                 \
+        decltype(var) this_cpu_value = (value);                         \
+        asm volatile ("mov %0, %%gs:%P1"                                \
+                      :: "r"(this_cpu_value), "i"(&(var)) : "memory");  \
+    } while (0)
+
+// Start of the calling CPU's copy of .percpu
+extern PER_CPU uintptr_t percpu_self;
+
+// Start of CPU `cpu`'s copy, or 0 if it doesn't have one yet
+uintptr_t percpu_base(unsigned cpu);
+
+// The calling CPU's copy of `var`, for anything that isn't a scalar
+// or needs more than a load or store
+template <typename T>
+inline T& this_cpu(T& var) {
+    return *(T*)(this_cpu_read(percpu_self) + (uintptr_t)&var);
+}
+
+// CPU `cpu`'s copy of `var`
+template <typename T>
+inline T& per_cpu(T& var, unsigned cpu) {
+    return *(T*)(percpu_base(cpu) + (uintptr_t)&var);
+}
+
+// Sets up the boot CPU's copy of .percpu and points its GS base at
+// it. This has to come before anything touches a PER_CPU variable.
+void init_boot_percpu();
+
+// Makes a fresh copy of .percpu for CPU `cpu`, which must not be
+// running yet. If `cpu` already has an area, from an earlier attempt
+// to start it, that's reused. Returns false if there's no memory for
+// it.
+bool alloc_percpu(unsigned cpu);
+
+// Points the calling CPU's GS base at the copy alloc_percpu made for
+// it
+void load_percpu(unsigned cpu);
+
+// Where the initial contents of .percpu are in the kernel image, which
+// has to stay reserved. The ELF section headers won't say, since the
+// section is linked at 0.
+uintptr_t percpu_image_phys();
+size_t percpu_size();
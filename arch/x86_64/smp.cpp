@@ -0,0 +1,185 @@
+#include "smp.hpp"
+#include "apic.hpp"
+#include "cpu.hpp"
+#include "descriptors.hpp"
+#include "interrupts.hpp"
+#include "kmemlayout.h"
+#include "logging.hpp"
+#include "paging.hpp"
+#include "page_allocator.hpp"
+#include "tlb.hpp"
+#include "virtual_allocator.hpp"
+
+// Each AP's stack, with an unmapped guard page below
+#define AP_STACK_SIZE 0x4000
+
+// How long to give an AP to show up after its startup IPIs
+#define AP_START_TIMEOUT_US 100000
+
+extern "C" const char smp_trampoline_start[];
+extern "C" const char smp_trampoline_data[];
+extern "C" const char smp_trampoline_end[];
+extern "C" void ap_start64();
+
+// The core's idle loop, which APs never come back from
+extern "C" void ap_main(unsigned cpu);
+
+namespace {
+    // The data block at the end of the trampoline
+    struct TrampolineData {
+        uint64_t cr3;
+        uint64_t stack;
+        uint64_t entry;
+        uint64_t cpu;
+    };
+}
+
+// How far the AP being started has got. It claims its slot on the way
+// into ap_entry, unless start_cpu has already given up on it.
+#define AP_WAITING 0
+#define AP_CLAIMED 1
+#define AP_RUNNING 2
+#define AP_ABANDONED 3
+
+static unsigned cpus_online = 1;
+static unsigned ap_state;
+// Kept for the next AP to get the same index when one doesn't start
+static uintptr_t ap_stacks[MAX_CPUS];
+
+unsigned cpu_count() {
+    return __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE);
+}
+
+void wake_cpu(unsigned cpu) {
+    LocalApic::global().send_fixed(cpu_local(cpu).apic_id, VECTOR_WAKEUP);
+}
+
+void Smp::init_trampoline() {
+    auto code = phys_to_virt<char>(SMP_TRAMPOLINE);
+    for (auto p = smp_trampoline_start; p < smp_trampoline_end; ++p) {
+        code[p - smp_trampoline_start] = *p;
+    }
+
+    // The first 2MB identity mapped, for the trampoline itself, and
+    // the kernel half as it is in the active tables
+    auto pml4 = phys_to_virt<uint64_t>(SMP_TRAMPOLINE_PML4);
+    auto pdp = phys_to_virt<uint64_t>(SMP_TRAMPOLINE_PDP);
+    auto pd = phys_to_virt<uint64_t>(SMP_TRAMPOLINE_PD);
+    auto kernel = phys_to_virt<uint64_t>(PageTable::current().physical());
+    for (size_t i = 0; i < 512; ++i) {
+        pml4[i] = i < 256 ? 0 : kernel[i];
+        pdp[i] = 0;
+        pd[i] = 0;
+    }
+    pml4[0] = SMP_TRAMPOLINE_PDP | PTE_PRESENT | PTE_WRITE;
+    pdp[0] = SMP_TRAMPOLINE_PD | PTE_PRESENT | PTE_WRITE;
+    pd[0] = PTE_LARGE | PTE_PRESENT | PTE_WRITE;
+}
+
+bool Smp::start_cpu(uint32_t apic_id) {
+    auto cpu = cpu_count();
+    if (cpu >= MAX_CPUS) {
+        return false;
+    }
+
+    auto stack = ap_stacks[cpu];
+    if (!stack) {
+        uintptr_t frames[AP_STACK_SIZE / PAGE_SIZE];
+        for (auto& frame : frames) {
+            frame = PageAllocator::global().alloc_order(0);
+            if (!frame) {
+                klog("Out of memory for CPU ", udec(cpu), "'s stack\n");
+                return false;
+            }
+        }
+        stack = VirtualAllocator::global().map_frames(frames, AP_STACK_SIZE / PAGE_SIZE,
+                                                      MemoryType::WriteBack, PAGE_SIZE);
+        if (!stack) {
+            klog("No room for CPU ", udec(cpu), "'s stack\n");
+            return false;
+        }
+        ap_stacks[cpu] = stack;
+    }
+
+    if (!alloc_percpu(cpu)) {
+        klog("Out of memory for CPU ", udec(cpu), "'s per-CPU area\n");
+        return false;
+    }
+    auto& local = cpu_local(cpu);
+    local.index = cpu;
+    local.apic_id = apic_id;
+    local.stack_top = stack + AP_STACK_SIZE;
+
+    auto data = phys_to_virt<TrampolineData>(SMP_TRAMPOLINE + (smp_trampoline_data - smp_trampoline_start));
+    data->cr3 = PageTable::current().physical();
+    data->stack = local.stack_top;
+    data->entry = (uint64_t)ap_start64;
+    data->cpu = cpu;
+    __atomic_store_n(&ap_state, AP_WAITING, __ATOMIC_RELEASE);
+
+    // INIT, then two startup IPIs, with the delays from the MP spec
+    auto& apic = LocalApic::global();
+    apic.send_init(apic_id);
+    delay_us(10000);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        apic.send_startup(apic_id, SMP_TRAMPOLINE >> 12);
+        delay_us(200);
+        if (__atomic_load_n(&ap_state, __ATOMIC_ACQUIRE) != AP_WAITING) {
+            break;
+        }
+    }
+    for (uint32_t waited = 0; waited < AP_START_TIMEOUT_US; waited += 100) {
+        if (__atomic_load_n(&ap_state, __ATOMIC_ACQUIRE) != AP_WAITING) {
+            break;
+        }
+        delay_us(100);
+    }
+
+    unsigned expected = AP_WAITING;
+    if (__atomic_compare_exchange_n(&ap_state, &expected, AP_ABANDONED, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // It hasn't touched anything of the index's yet. INIT puts it
+        // back to waiting for a startup IPI it won't get, so a late
+        // arrival can't come through the trampoline with the next
+        // AP's data. The stack and per-CPU area go to that AP.
+        apic.send_init(apic_id);
+        klog("CPU with APIC ID ", udec(apic_id), " didn't start\n");
+        return false;
+    }
+
+    // Once it's claimed the index, it's running our code, and will
+    // get to the end of it
+    while (__atomic_load_n(&ap_state, __ATOMIC_ACQUIRE) != AP_RUNNING) {
+        cpu_relax();
+    }
+    __atomic_store_n(&cpus_online, cpu + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// First C++ on an AP, with the segments from the trampoline's GDT
+// (which isn't mapped any more) and no IDT. Nothing here may log: until
+// kmain defers logging, klog writes straight to the sink, and the
+// sinks only take one writer.
+extern "C" void ap_entry(unsigned cpu) {
+    unsigned expected = AP_WAITING;
+    if (!__atomic_compare_exchange_n(&ap_state, &expected, AP_CLAIMED, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Too late: start_cpu has given up, and its INIT is on the way
+        while (true) {
+            disable_interrupts();
+            halt();
+        }
+    }
+    load_percpu(cpu);
+    load_cpu_descriptors(this_cpu(cpu_local_data).stack_top);
+    asm volatile ("mov %w0, %%ds\n\t"
+                  "mov %w0, %%es\n\t"
+                  "mov %w0, %%ss" :: "r"(KERNEL_DATA_SEGMENT));
+    load_interrupts();
+    Tlb::init();
+    PageTable::init_memory_types();
+    LocalApic::global().enable();
+
+    __atomic_store_n(&ap_state, AP_RUNNING, __ATOMIC_RELEASE);
+    ap_main(cpu);
+}
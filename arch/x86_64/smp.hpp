@@ -0,0 +1,22 @@
+#pragma once
+
+#include "stdint.h"
+
+// Busy-waits for at least `us` microseconds. Starting CPUs needs real
+// delays before we have a calibrated clock of our own, so the
+// platform provides this from whatever timer it has.
+void delay_us(uint32_t us);
+
+// Bringing up the application processors. Once the boot CPU's local
+// APIC is up, it calls init_trampoline once, then start_cpu for each AP
+// in turn.
+namespace Smp {
+    // Copies the trampoline to SMP_TRAMPOLINE and builds its page
+    // tables. The platform has to keep that memory out of the page
+    // allocator.
+    void init_trampoline();
+
+    // Starts the AP with `apic_id` as CPU `cpu_count()`, and waits for
+    // it to get to its idle loop. Returns false if it doesn't turn up.
+    bool start_cpu(uint32_t apic_id);
+}
@@ -0,0 +1,233 @@
+#include "tlb.hpp"
+#include "cpu.hpp"
+#include "logging.hpp"
+#include "apic.hpp"
+#include "interrupts.hpp"
+#include "spinlock.hpp"
+
+#define CR3_NOFLUSH (1ul << 63)
+#define CR4_PGE (1ul << 7)
+#define CR4_PCIDE (1ul << 17)
+
+// PCIDs handed out per CPU. 0 is left for the boot tables, and for
+// everything when PCIDs aren't available.
+#define NUM_PCIDS 8
+
+size_t Tlb::flush_crossover = 32;
+Tlb::ShootdownFn Tlb::shootdown = nullptr;
+
+static bool pcid_enabled;
+
+namespace {
+    struct PcidCache {
+        // pml4 tagged with PCID i+1, or 0
+        uintptr_t tables[NUM_PCIDS];
+        unsigned next;
+    };
+}
+
+static PER_CPU PcidCache pcid_cache;
+
+namespace {
+    // The shootdown in flight. Only the holder of shootdown_lock
+    // writes it, and not again until every other CPU has applied it.
+    struct Shootdown {
+        uintptr_t pml4;
+        uintptr_t pages[TlbBatch::MAX_PAGES];
+        // 0 for a full flush
+        size_t count;
+        // CPUs yet to apply it
+        unsigned pending;
+        // Bumped, last, for each new shootdown
+        uint64_t generation;
+    };
+}
+
+static Shootdown shootdown_request;
+static TicketLock shootdown_lock;
+// The last generation this CPU applied
+static PER_CPU uint64_t shootdown_seen;
+
+void Tlb::init() {
+    auto& features = CpuFeatures::global();
+    auto cr4 = read_cr4();
+    if (features.global_pages) {
+        cr4 |= CR4_PGE;
+    }
+    // PCIDE can only be set with PCID 0 in CR3, which is what the boot
+    // tables use.
+    if (features.pcid) {
+        cr4 |= CR4_PCIDE;
+        pcid_enabled = true;
+    }
+    write_cr4(cr4);
+    // A CPU coming up has nothing stale to throw out
+    this_cpu_write(shootdown_seen, __atomic_load_n(&shootdown_request.generation, __ATOMIC_ACQUIRE));
+    if (cpu_index() != 0) {
+        return;
+    }
+    klog("TLB: ", features.global_pages ? "global pages" : "no global pages",
+         ", ", pcid_enabled ? "PCIDs" : "no PCIDs", "\n");
+}
+
+void Tlb::switch_to(uintptr_t pml4) {
+    if (!pcid_enabled) {
+        write_cr3(pml4);
+        return;
+    }
+
+    // A shootdown landing between the lookup and the CR3 write could
+    // drop the PCID we're about to load without a flush
+    InterruptGuard interrupts;
+    auto& cache = this_cpu(pcid_cache);
+    for (unsigned i = 0; i < NUM_PCIDS; ++i) {
+        if (__atomic_load_n(&cache.tables[i], __ATOMIC_ACQUIRE) == pml4) {
+            write_cr3(pml4 | (i + 1) | CR3_NOFLUSH);
+            return;
+        }
+    }
+    // Take over the oldest PCID. Loading it without NOFLUSH throws out
+    // whatever the previous owner left behind.
+    auto i = cache.next;
+    cache.next = (cache.next + 1) % NUM_PCIDS;
+    __atomic_store_n(&cache.tables[i], pml4, __ATOMIC_RELEASE);
+    write_cr3(pml4 | (i + 1));
+}
+
+void Tlb::forget(uintptr_t pml4) {
+    if (!pcid_enabled) {
+        return;
+    }
+    // A CPU still running on the table keeps its PCID until it
+    // switches away, but won't come back to it without a flush.
+    for (unsigned cpu = 0; cpu < cpu_count(); ++cpu) {
+        for (auto& table : per_cpu(pcid_cache, cpu).tables) {
+            if (table == pml4) {
+                __atomic_store_n(&table, 0, __ATOMIC_RELEASE);
+            }
+        }
+    }
+}
+
+void Tlb::flush_all() {
+    // Toggling PGE flushes every entry for every PCID.
+    auto cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+// Applies the shootdown in flight, unless this CPU already has
+static void apply_shootdown() {
+    auto& request = shootdown_request;
+    auto generation = __atomic_load_n(&request.generation, __ATOMIC_ACQUIRE);
+    if (this_cpu_read(shootdown_seen) == generation) {
+        return;
+    }
+    if (request.count == 0) {
+        Tlb::flush_all();
+    } else {
+        // invlpg only reaches the current PCID (and global entries).
+        // If the table is tagged under another one, that tag is
+        // dropped, so switching back to it flushes.
+        for (size_t i = 0; i < request.count; ++i) {
+            invlpg(request.pages[i]);
+        }
+        if (pcid_enabled && (read_cr3() & ~PAGE_MASK) != request.pml4) {
+            for (auto& table : this_cpu(pcid_cache).tables) {
+                if (table == request.pml4) {
+                    __atomic_store_n(&table, 0, __ATOMIC_RELEASE);
+                }
+            }
+        }
+    }
+    this_cpu_write(shootdown_seen, generation);
+    __atomic_fetch_sub(&request.pending, 1, __ATOMIC_RELEASE);
+}
+
+static bool shootdown_irq(InterruptFrame*, void*) {
+    apply_shootdown();
+    return true;
+}
+
+static void send_shootdown(uintptr_t pml4, const uintptr_t* pages, size_t count) {
+    auto others = cpu_count() - 1;
+    if (!others) {
+        return;
+    }
+
+    auto& request = shootdown_request;
+    InterruptGuard interrupts;
+    // Whoever holds the lock is waiting on us, and our interrupts are
+    // off, so answer them by hand until it's our turn
+    while (!shootdown_lock.try_lock()) {
+        apply_shootdown();
+        cpu_relax();
+    }
+    request.pml4 = pml4;
+    request.count = pages ? count : 0;
+    for (size_t i = 0; i < request.count; ++i) {
+        request.pages[i] = pages[i];
+    }
+    __atomic_store_n(&request.pending, others, __ATOMIC_RELAXED);
+    auto generation = request.generation + 1;
+    this_cpu_write(shootdown_seen, generation);
+    __atomic_store_n(&request.generation, generation, __ATOMIC_RELEASE);
+
+    LocalApic::global().send_all_others(VECTOR_TLB_SHOOTDOWN);
+    while (__atomic_load_n(&request.pending, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    shootdown_lock.unlock();
+}
+
+void Tlb::init_shootdown() {
+    static InterruptAction action = {shootdown_irq, nullptr, "TLB shootdown", nullptr};
+    shootdown_lock.track("tlb shootdown");
+    add_interrupt_handler(VECTOR_TLB_SHOOTDOWN, action);
+    shootdown = send_shootdown;
+}
+
+void TlbBatch::add(uintptr_t virt) {
+    if (virt >= KERNEL_HALF_START) {
+        m_kernel = true;
+    }
+    if (m_full) {
+        return;
+    }
+    if (m_count == MAX_PAGES || m_count >= Tlb::flush_crossover) {
+        m_full = true;
+        return;
+    }
+    m_pages[m_count++] = virt & ~PAGE_MASK;
+}
+
+void TlbBatch::flush() {
+    if (!m_full && m_count == 0) {
+        return;
+    }
+
+    if (m_full) {
+        // Only kernel mappings can be global. Otherwise reloading CR3
+        // is enough, and only flushes the current PCID.
+        if (m_kernel) {
+            Tlb::flush_all();
+        } else {
+            write_cr3(read_cr3());
+        }
+    } else {
+        for (size_t i = 0; i < m_count; ++i) {
+            invlpg(m_pages[i]);
+        }
+    }
+
+    if (Tlb::shootdown) {
+        Tlb::shootdown(read_cr3() & ~PAGE_MASK, m_full ? nullptr : m_pages, m_count);
+    }
+    m_count = 0;
+    m_full = false;
+    m_kernel = false;
+}
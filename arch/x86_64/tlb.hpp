@@ -0,0 +1,68 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "kmemlayout.h"
+
+namespace Tlb {
+    // Turns on global pages for the kernel half, and PCIDs if the CPU
+    // has them. Every CPU runs this as it comes up.
+    void init();
+
+    // Loads `pml4` into CR3. With PCIDs, each CPU keeps a few recently
+    // used address spaces tagged in the TLB, and switching back to one
+    // of them doesn't flush anything.
+    void switch_to(uintptr_t pml4);
+
+    // Drops any tagged TLB entries for `pml4` on every CPU. Needed when
+    // a table that isn't active is changed, or freed (its address
+    // could come back as a different table).
+    void forget(uintptr_t pml4);
+
+    // Flushes everything, global entries included
+    void flush_all();
+
+    // Batches with more than this many pages are applied with a full
+    // flush instead of one invlpg per page. Capped by
+    // TlbBatch::MAX_PAGES.
+    extern size_t flush_crossover;
+
+    // Called once per batch, to pass the invalidation on to other
+    // CPUs. `pml4` is the table that changed, so CPUs that only have
+    // it tagged under an inactive PCID know to drop it. `pages` is null
+    // if they should flush everything. Null until init_shootdown.
+    typedef void (*ShootdownFn)(uintptr_t pml4, const uintptr_t* pages, size_t count);
+    extern ShootdownFn shootdown;
+
+    // Sets shootdown to one that sends an IPI on VECTOR_TLB_SHOOTDOWN
+    // to every other CPU and waits for them all to apply it. Needs the
+    // local APIC; the boot CPU calls it before starting any others.
+    void init_shootdown();
+}
+
+// Collects pages whose mappings changed in the active table, so they
+// can be invalidated in one go once the table is consistent again:
+// page by page if there are only a few, or with a single full flush
+// otherwise. Flushes on destruction.
+class TlbBatch {
+public:
+    TlbBatch() = default;
+    ~TlbBatch() { flush(); }
+
+    TlbBatch(const TlbBatch&) = delete;
+    TlbBatch& operator=(const TlbBatch&) = delete;
+
+    // A page (of any size) containing `virt` was changed
+    void add(uintptr_t virt);
+    void flush();
+
+    static constexpr size_t MAX_PAGES = 64;
+
+private:
+    uintptr_t m_pages[MAX_PAGES];
+    size_t m_count = 0;
+    bool m_full = false;
+    // Whether any of the pages are in the kernel half, and might be
+    // global
+    bool m_kernel = false;
+};
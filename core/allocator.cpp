@@ -2,10 +2,140 @@
 
 #include "allocator.hpp"
 #include "logging.hpp"
+#include "page_allocator.hpp"
+#include "page.hpp"
+#include "paging.hpp"
+#include "demand_paging.hpp"
 
-Allocator& Allocator::global() {
-    static Allocator instance;
-    return instance;
+#define SLAB_COOKIE 0x51AB'0000'0000'51ABull
+#define BLOCK_MAGIC 0xDECAF'00000'C0FFEE
+
+// Size classes are spaced roughly 25% apart, so internal
+// fragmentation stays bounded without needing dozens of classes.
+static constexpr size_t class_sizes[Allocator::NUM_SIZE_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024,
+};
+
+// Maps a request size (in ALLOC_ALIGN units, rounded up) directly to
+// its size class, so picking a class is a single table load.
+struct ClassLookup {
+    uint8_t index[Allocator::SMALL_MAX / ALLOC_ALIGN + 1];
+
+    constexpr ClassLookup() : index() {
+        size_t size_class = 0;
+        for (size_t i = 0; i <= Allocator::SMALL_MAX / ALLOC_ALIGN; ++i) {
+            while (class_sizes[size_class] < i * ALLOC_ALIGN) {
+                size_class++;
+            }
+            index[i] = size_class;
+        }
+    }
+};
+
+static constexpr ClassLookup class_lookup;
+
+__constinit Allocator Allocator::instance;
+
+void Allocator::init(uintptr_t start, size_t size) {
+    m_heap_start = start;
+    m_heap_end = start + size;
+    m_reserve = size / 4 < HEAP_RESERVE ? size / 4 : HEAP_RESERVE;
+    add_region(start, size - m_reserve);
+    m_lock.track("heap");
+    DemandPaging::global().reserve("heap", m_heap_end, KERNEL_HEAP_END - m_heap_end, PageOwner::Heap);
+}
+
+bool Allocator::grow(size_t size) {
+    // If something allocates while we're growing and the reserve
+    // doesn't cover it, we really are out of memory.
+    if (m_growing) {
+        return false;
+    }
+    m_growing = true;
+    if (m_reserve) {
+        add_region(m_heap_end - m_reserve, m_reserve);
+        m_reserve = 0;
+    }
+
+    // Grow by about the current heap size, so the number of growth
+    // steps stays logarithmic in the heap size.
+    size_t heap_size = m_heap_end - m_heap_start;
+    size_t chunk = heap_size;
+    if (chunk < m_growth.min_chunk) {
+        chunk = m_growth.min_chunk;
+    }
+    if (chunk > m_growth.max_chunk) {
+        chunk = m_growth.max_chunk;
+    }
+    // Make sure the new space covers the request, its header, and the
+    // reserve we hold back from it.
+    auto needed = size + ALLOC_ALIGN * 2 + HEAP_RESERVE;
+    if (chunk < needed) {
+        chunk = needed;
+    }
+
+    bool big_pages = heap_size >= m_growth.big_page_threshold;
+    auto start = m_heap_end;
+    auto end = start + chunk;
+    if (big_pages) {
+        end = (end + BIG_PAGE_MASK) & ~BIG_PAGE_MASK;
+    } else {
+        end = (end + PAGE_MASK) & ~PAGE_MASK;
+    }
+    if (end > KERNEL_HEAP_END) {
+        end = KERNEL_HEAP_END;
+    }
+
+    if (m_growth.demand_paged) {
+        // Nothing to map: the first touch of each page faults it in.
+        m_heap_end = end;
+        add_region(start, end - start);
+        m_growing = false;
+        return end - start >= needed;
+    }
+
+    auto& pages = PageAllocator::global();
+    auto table = PageTable::current();
+    auto addr = start;
+    while (addr < end) {
+        // Big-page-aligned stretches get big frames, so they can be
+        // mapped with a single entry. If there are none left we fall
+        // back to small pages.
+        size_t step = PAGE_SIZE;
+        uintptr_t frame = 0;
+        if (big_pages && (addr & BIG_PAGE_MASK) == 0 && end - addr >= BIG_PAGE_SIZE) {
+            step = BIG_PAGE_SIZE;
+            frame = pages.alloc(step);
+        }
+        if (!frame) {
+            step = PAGE_SIZE;
+            frame = pages.alloc(step);
+        }
+        if (!frame) {
+            break;
+        }
+        if (!table.map(frame, addr, step)) {
+            pages.free(frame, PageAllocator::order_for(step));
+            break;
+        }
+        if (auto page = phys_to_page(frame)) {
+            page->owner = PageOwner::Heap;
+        }
+        addr += step;
+    }
+    m_heap_end = addr;
+
+    auto grown = addr - start;
+    if (grown > HEAP_RESERVE) {
+        m_reserve = HEAP_RESERVE;
+        add_region(start, grown - HEAP_RESERVE);
+    } else if (grown) {
+        add_region(start, grown);
+    }
+    m_growing = false;
+    return grown >= needed;
 }
 
 void Allocator::add_region(uintptr_t addr, size_t size) {
@@ -62,6 +192,167 @@ void Allocator::add_region(uintptr_t addr, size_t size) {
 }
 
 void* Allocator::alloc(size_t size) {
+    IrqSaveGuard<TicketLock> guard(m_lock);
+    if (size <= SMALL_MAX) {
+        return alloc_small(class_lookup.index[(size + ALLOC_MASK) / ALLOC_ALIGN]);
+    }
+    return alloc_large(size);
+}
+
+void Allocator::dealloc(void* addr) {
+    if (addr == nullptr) {
+        return;
+    }
+    IrqSaveGuard<TicketLock> guard(m_lock);
+    // Slab objects never sit at the very start of a page, since that's
+    // where the slab header lives.
+    auto slab = (Slab*)((uintptr_t)addr & ~PAGE_MASK);
+    if ((uintptr_t)addr != (uintptr_t)slab && slab->cookie == (SLAB_COOKIE ^ (uintptr_t)slab)) {
+        dealloc_small(slab, addr);
+    } else {
+        dealloc_large(addr);
+    }
+}
+
+void* Allocator::alloc_small(size_t size_class) {
+    auto& cls = m_classes[size_class];
+    auto slab = cls.partial;
+    if (!slab) {
+        slab = create_slab(size_class);
+        if (!slab) {
+            return nullptr;
+        }
+        slab->next = nullptr;
+        slab->prev = nullptr;
+        cls.partial = slab;
+        cls.slabs++;
+        cls.empty_slabs++;
+    }
+
+    if (slab->in_use == 0) {
+        cls.empty_slabs--;
+    }
+    auto object = slab->free;
+    slab->free = object->next;
+    slab->in_use++;
+    cls.in_use++;
+
+    // A full slab drops off the partial list. We'll find it again
+    // through the object address when something in it is freed.
+    if (slab->free == nullptr) {
+        cls.partial = slab->next;
+        if (slab->next) {
+            slab->next->prev = nullptr;
+        }
+    }
+    return object;
+}
+
+void Allocator::dealloc_small(Slab* slab, void* addr) {
+    auto& cls = m_classes[slab->size_class];
+    auto object = (FreeObject*)addr;
+
+    if (slab->free == nullptr) {
+        // This slab was full, so it goes back on the partial list
+        slab->prev = nullptr;
+        slab->next = cls.partial;
+        if (cls.partial) {
+            cls.partial->prev = slab;
+        }
+        cls.partial = slab;
+    }
+    object->next = slab->free;
+    slab->free = object;
+    slab->in_use--;
+    cls.in_use--;
+
+    if (slab->in_use != 0) {
+        return;
+    }
+
+    // Keep one empty slab around per class so an alloc/free pair at
+    // a slab boundary doesn't bounce pages in and out of the
+    // freelist. Any more than that go back to the freelist.
+    if (cls.empty_slabs == 0) {
+        cls.empty_slabs++;
+        return;
+    }
+    (slab->prev ? slab->prev->next : cls.partial) = slab->next;
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    cls.slabs--;
+    slab->cookie = 0;
+    add_region((uintptr_t)slab, PAGE_SIZE);
+}
+
+Allocator::Slab* Allocator::create_slab(size_t size_class) {
+    auto size = class_sizes[size_class];
+    auto slab = (Slab*)alloc_page();
+    if (!slab) {
+        return nullptr;
+    }
+
+    // Objects start at the first aligned address after the header
+    auto first = ((uintptr_t)slab + sizeof(Slab) + ALLOC_MASK) & ~ALLOC_MASK;
+    auto capacity = ((uintptr_t)slab + PAGE_SIZE - first) / size;
+
+    slab->cookie = SLAB_COOKIE ^ (uintptr_t)slab;
+    slab->size_class = size_class;
+    slab->in_use = 0;
+    slab->capacity = capacity;
+    slab->free = nullptr;
+    // Thread the freelist backwards so objects are handed out in
+    // address order.
+    for (size_t i = capacity; i > 0; --i) {
+        auto object = (FreeObject*)(first + (i - 1) * size);
+        object->next = slab->free;
+        slab->free = object;
+    }
+    return slab;
+}
+
+uintptr_t Allocator::alloc_page() {
+    // Slabs need to be page-aligned so we can find their header from
+    // an object address. Carve the highest aligned page we can out
+    // of the first chunk that has one.
+    FreeChunk* prev = nullptr;
+    auto chunk = m_head;
+    while (true) {
+        if (!chunk) {
+            if (!grow(PAGE_SIZE * 2)) {
+                break;
+            }
+            prev = nullptr;
+            chunk = m_head;
+            continue;
+        }
+        auto start = (uintptr_t)chunk;
+        auto end = start + chunk->size;
+        if (chunk->size >= PAGE_SIZE) {
+            auto page = (end - PAGE_SIZE) & ~PAGE_MASK;
+            if (page >= start) {
+                if (page - start >= ALLOC_ALIGN * 2) {
+                    chunk->size = page - start;
+                } else {
+                    // The leftover head is too small to track. Leak
+                    // it, same as add_region does.
+                    (prev ? prev->next : m_head) = chunk->next;
+                }
+                if (end > page + PAGE_SIZE) {
+                    add_region(page + PAGE_SIZE, end - (page + PAGE_SIZE));
+                }
+                return page;
+            }
+        }
+        prev = chunk;
+        chunk = chunk->next;
+    }
+    klog("Out of memory to allocate a slab!\n");
+    return 0;
+}
+
+void* Allocator::alloc_large(size_t size) {
     // Round up size to a multiple of our alloc alignment
     if ((size & ALLOC_MASK) != 0) {
         size += ALLOC_ALIGN;
@@ -74,7 +365,15 @@ void* Allocator::alloc(size_t size) {
     // allocation off the end of it.
     FreeChunk* prev = nullptr;
     auto chunk = m_head;
-    while (chunk) {
+    while (true) {
+        if (!chunk) {
+            if (!grow(size)) {
+                break;
+            }
+            prev = nullptr;
+            chunk = m_head;
+            continue;
+        }
         if (chunk->size >= size) {
             chunk->size -= size;
             size_t* block = nullptr;
@@ -88,22 +387,20 @@ void* Allocator::alloc(size_t size) {
                 block = (size_t*)((uintptr_t)chunk + chunk->size);
             }
             block[0] = size;
-            block[1] = 0xDECAF'00000'C0FFEE;
+            block[1] = BLOCK_MAGIC;
             return (void*)(&block[2]);
         }
         prev = chunk;
         chunk = chunk->next;
     }
-    // TODO: Request a new chunk of virtual memory, and pages to populate it.
-    // TOOD: How much should we allocate at a time?
-    klog("Out of memory to allocate!");
-    while(true) {};
+    klog("Out of memory to allocate ", size, " bytes!\n");
+    return nullptr;
 }
 
-void Allocator::dealloc(void* addr) {
+void Allocator::dealloc_large(void* addr) {
     auto block_addr = (uintptr_t)addr - ALLOC_ALIGN;
     auto block = (uintptr_t*)block_addr;
-    if (block[1] != 0xDECAF'00000'C0FFEE) {
+    if (block[1] != BLOCK_MAGIC) {
         klog("Tried to free a non-allocated region. Ignoring\n");
         return;
     }
@@ -117,4 +414,11 @@ void Allocator::dump() const {
         klog((uintptr_t)chunk,":", chunk->size+(uintptr_t)chunk, "\n");
         chunk = chunk->next;
     }
+    klog("*Slabs*\n");
+    for (size_t i = 0; i < NUM_SIZE_CLASSES; ++i) {
+        auto& cls = m_classes[i];
+        if (cls.slabs) {
+            klog(class_sizes[i], ": ", cls.slabs, " slabs, ", cls.in_use, " in use\n");
+        }
+    }
 }
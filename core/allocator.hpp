@@ -2,10 +2,34 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "spinlock.hpp"
 
 class Allocator {
 public:
-    static Allocator& global();
+    // A constant-initialized global, so new and delete reach it
+    // directly, without a guard check
+    static Allocator& global() { return instance; }
+
+    // Sets up the heap over an initial region that is already
+    // mapped, which may be empty. Once it runs out, the heap grows
+    // upwards from the end of that region. The rest of the heap's
+    // address space is demand paged, so anything grown into gets
+    // memory on first touch.
+    void init(uintptr_t start, size_t size);
+
+    // How the heap grows: each step adds at least min_chunk bytes,
+    // doubling with the size of the heap up to max_chunk. With
+    // demand_paged set, growing only moves the end of the heap and
+    // pages are faulted in as they're used. Otherwise each step is
+    // mapped up front, and once the heap is big_page_threshold bytes
+    // it grows in whole big pages.
+    struct GrowthPolicy {
+        size_t min_chunk;
+        size_t max_chunk;
+        size_t big_page_threshold;
+        bool demand_paged;
+    };
+    void growth_policy(const GrowthPolicy& policy) { m_growth = policy; }
 
     void add_region(uintptr_t start, size_t size);
 
@@ -14,11 +38,77 @@ public:
 
     void dump() const;
 
+    // Requests up to this size are served from the slab caches. Anything
+    // larger goes to the first-fit freelist.
+    static constexpr size_t SMALL_MAX = 1024;
+    static constexpr size_t NUM_SIZE_CLASSES = 20;
+
 private:
+    constexpr Allocator()
+        : m_classes{}, m_head(), m_lock(), m_heap_start(), m_heap_end(),
+          m_reserve(), m_growing() {}
+
+    static Allocator instance;
+
     struct FreeChunk {
         size_t size;
         FreeChunk* next;
     };
 
+    // Each slab is a single page carved out of the freelist. It starts
+    // with this header, and the rest of the page is split into
+    // equal-sized objects. Free objects are threaded through
+    // themselves.
+    struct FreeObject {
+        FreeObject* next;
+    };
+
+    struct Slab {
+        // SLAB_COOKIE xor'd with the slab address. This is how dealloc
+        // tells slab objects apart from freelist blocks.
+        uintptr_t cookie;
+        Slab* prev;
+        Slab* next;
+        FreeObject* free;
+        uint16_t size_class;
+        uint16_t in_use;
+        uint16_t capacity;
+    };
+
+    struct SizeClass {
+        // Slabs with at least one free object. Full slabs aren't
+        // tracked at all until something in them is freed.
+        Slab* partial;
+        size_t slabs;
+        size_t empty_slabs;
+        size_t in_use;
+    };
+
+    SizeClass m_classes[NUM_SIZE_CLASSES];
     FreeChunk* m_head;
+
+    // Taken by alloc and dealloc with interrupts off, and held across
+    // growing the heap. Nothing under it may allocate from the heap.
+    TicketLock m_lock;
+
+    // Growing the heap must not recurse back into itself, so a little
+    // of the heap is held back and only released to the freelist while
+    // growing, in case anything on that path allocates.
+    static constexpr size_t HEAP_RESERVE = 0x2000;
+
+    GrowthPolicy m_growth = {0x10000, 0x400000, 0x800000, true};
+    uintptr_t m_heap_start;
+    uintptr_t m_heap_end;
+    size_t m_reserve;
+    bool m_growing;
+
+    bool grow(size_t size);
+
+    void* alloc_small(size_t size_class);
+    void dealloc_small(Slab* slab, void* addr);
+    void* alloc_large(size_t size);
+    void dealloc_large(void* addr);
+
+    Slab* create_slab(size_t size_class);
+    uintptr_t alloc_page();
 };
@@ -16,4 +16,11 @@ struct BootInfo {
     } elf;
 
     String cmdline;
+
+    // A copy of the ACPI RSDP (or XSDP, if the bootloader gave us
+    // one) from the multiboot information.
+    struct Acpi {
+        uint8_t rsdp[36];
+        size_t rsdp_size;
+    } acpi;
 };
@@ -0,0 +1,105 @@
+#include "demand_paging.hpp"
+#include "kmemlayout.h"
+#include "logging.hpp"
+#include "page_allocator.hpp"
+#include "paging.hpp"
+
+DemandPaging& DemandPaging::global() {
+    static DemandPaging instance;
+    return instance;
+}
+
+bool DemandPaging::reserve(const char* name, uintptr_t start, size_t size,
+                           PageOwner owner, FillFn fill) {
+    IrqSaveGuard<SpinLock> guard(m_lock);
+    auto end = start + size;
+    if (m_count == MAX_REGIONS) {
+        klog("Too many demand paged regions, can't add ", name, "\n");
+        return false;
+    }
+    for (size_t i = 0; i < m_count; ++i) {
+        if (start < m_regions[i].end && m_regions[i].start < end) {
+            klog("Demand paged region ", name, " overlaps ", m_regions[i].name, "\n");
+            return false;
+        }
+    }
+    m_regions[m_count++] = {name, start, end, owner, fill, 0, 0};
+    return true;
+}
+
+DemandPaging::Region* DemandPaging::find(uintptr_t addr) {
+    for (size_t i = 0; i < m_count; ++i) {
+        if (addr >= m_regions[i].start && addr < m_regions[i].end) {
+            return &m_regions[i];
+        }
+    }
+    return nullptr;
+}
+
+bool DemandPaging::back(Region& region, uintptr_t page) {
+    auto& pages = PageAllocator::global();
+    auto frame = pages.alloc_zeroed();
+    if (!frame) {
+        klog("Out of memory backing ", region.name, " at ", page, "\n");
+        return false;
+    }
+    if (region.fill) {
+        region.fill(phys_to_virt(frame));
+    }
+    if (!PageTable::current().map(frame, page, PAGE_SIZE)) {
+        pages.free(frame, 0);
+        return false;
+    }
+    if (auto info = phys_to_page(frame)) {
+        info->owner = region.owner;
+    }
+    return true;
+}
+
+bool DemandPaging::populate(uintptr_t start, size_t size) {
+    IrqSaveGuard<SpinLock> guard(m_lock);
+    auto region = find(start);
+    if (!region || start + size > region->end) {
+        return false;
+    }
+    auto table = PageTable::current();
+    auto end = start + size;
+    for (auto page = start & ~PAGE_MASK; page < end; page += PAGE_SIZE) {
+        if (table.physical(page)) {
+            continue;
+        }
+        if (!back(*region, page)) {
+            return false;
+        }
+        region->populated++;
+    }
+    return true;
+}
+
+bool DemandPaging::handle_fault(uintptr_t addr) {
+    IrqSaveGuard<SpinLock> guard(m_lock);
+    auto region = find(addr);
+    if (!region) {
+        return false;
+    }
+    // Another CPU may have faulted on the same page while we were
+    // waiting for the lock.
+    auto page = addr & ~PAGE_MASK;
+    if (PageTable::current().physical(page)) {
+        return true;
+    }
+    if (!back(*region, page)) {
+        return false;
+    }
+    region->faults++;
+    return true;
+}
+
+void DemandPaging::dump() const {
+    klog("==Demand Paging==\n");
+    for (size_t i = 0; i < m_count; ++i) {
+        auto& region = m_regions[i];
+        klog(region.name, " ", region.start, ":", region.end, ": ",
+             region.faults, " faults, ", region.populated, " populated\n");
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "page.hpp"
+#include "spinlock.hpp"
+
+// Kernel virtual ranges that are reserved up front and only backed by
+// memory when they're touched. The page fault handler maps a fresh
+// zeroed frame for each page on first access, so big sparse
+// structures only cost the memory they actually use.
+//
+// Faults are handled with the region lock held and may allocate from
+// the PageAllocator, so nothing the page allocator touches may live in
+// an unpopulated part of a region.
+class DemandPaging {
+public:
+    static DemandPaging& global();
+
+    // Called on every freshly mapped page before it's visible, for
+    // regions where zero isn't a good initial value.
+    typedef void (*FillFn)(void* page);
+
+    // Reserves [start, start + size). Returns false if the range
+    // overlaps an existing region or there's no room for another.
+    bool reserve(const char* name, uintptr_t start, size_t size,
+                 PageOwner owner, FillFn fill = nullptr);
+
+    // Backs every page of [start, start + size) that isn't mapped yet,
+    // without waiting for a fault. The range must be inside a region.
+    bool populate(uintptr_t start, size_t size);
+
+    // Maps the page containing `addr` if it's in a region. Returns
+    // false if the fault isn't ours, or we're out of memory.
+    bool handle_fault(uintptr_t addr);
+
+    void dump() const;
+
+    static constexpr size_t MAX_REGIONS = 16;
+
+private:
+    struct Region {
+        const char* name;
+        uintptr_t start;
+        uintptr_t end;
+        PageOwner owner;
+        FillFn fill;
+        // Pages mapped by handle_fault and by populate
+        uint64_t faults;
+        uint64_t populated;
+    };
+
+    Region m_regions[MAX_REGIONS];
+    size_t m_count;
+    // Held with interrupts off, since an interrupt handler can fault on
+    // a heap page that isn't backed yet
+    SpinLock m_lock;
+
+    Region* find(uintptr_t addr);
+    bool back(Region& region, uintptr_t page);
+};
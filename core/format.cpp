@@ -0,0 +1,101 @@
+#include "format.hpp"
+
+namespace {
+
+// "00", "01", ... "99", so decimal goes out two digits per divide
+struct DigitPairs {
+    char digits[200];
+
+    constexpr DigitPairs() : digits() {
+        for (int i = 0; i < 100; ++i) {
+            digits[i * 2] = '0' + i / 10;
+            digits[i * 2 + 1] = '0' + i % 10;
+        }
+    }
+};
+
+constexpr DigitPairs digit_pairs;
+
+// Spreads the eight nybbles of `value` out into the low half of each
+// byte, most significant first in memory
+inline uint64_t spread_nybbles(uint32_t value) {
+    uint64_t v = value;
+    v = (v | v << 16) & 0x0000ffff0000ffff;
+    v = (v | v << 8) & 0x00ff00ff00ff00ff;
+    v = (v | v << 4) & 0x0f0f0f0f0f0f0f0f;
+    return __builtin_bswap64(v);
+}
+
+// Turns eight spread nybbles into ASCII without looking at any of
+// them: bytes of 10 or more pick up the gap between '9' and 'A'
+inline uint64_t nybbles_to_ascii(uint64_t v) {
+    auto letters = ((v + 0x0606060606060606) >> 4) & 0x0101010101010101;
+    return v + 0x3030303030303030 + letters * 7;
+}
+
+}
+
+size_t format_dec(char* out, uint64_t value) {
+    char buffer[20];
+    auto p = buffer + sizeof(buffer);
+    while (value >= 100) {
+        auto pair = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = digit_pairs.digits[pair];
+        p[1] = digit_pairs.digits[pair + 1];
+    }
+    if (value >= 10) {
+        p -= 2;
+        p[0] = digit_pairs.digits[value * 2];
+        p[1] = digit_pairs.digits[value * 2 + 1];
+    } else {
+        *--p = '0' + value;
+    }
+
+    size_t length = buffer + sizeof(buffer) - p;
+    for (size_t i = 0; i < length; ++i) {
+        out[i] = p[i];
+    }
+    return length;
+}
+
+size_t format_hex(char* out, uint64_t value) {
+    // All sixteen digits are made at once, then the leading zeros are
+    // just not copied
+    uint64_t digits[2] = {
+        nybbles_to_ascii(spread_nybbles(value >> 32)),
+        nybbles_to_ascii(spread_nybbles(value)),
+    };
+    size_t length = (64 - __builtin_clzll(value | 1) + 3) / 4;
+    auto p = reinterpret_cast<const char*>(digits) + 16 - length;
+    for (size_t i = 0; i < length; ++i) {
+        out[i] = p[i];
+    }
+    return length;
+}
+
+size_t format_radix(char* out, uint64_t value, uint8_t base) {
+    if (base == 10) {
+        return format_dec(out, value);
+    }
+    if (base == 16) {
+        return format_hex(out, value);
+    }
+    if (base < 2 || base > 16) {
+        base = 16;
+    }
+
+    char buffer[FORMAT_MAX_DIGITS];
+    auto p = buffer + sizeof(buffer);
+    do {
+        *--p = "0123456789ABCDEF"[value % base];
+        value /= base;
+    } while (value);
+
+    size_t length = buffer + sizeof(buffer) - p;
+    for (size_t i = 0; i < length; ++i) {
+        out[i] = p[i];
+    }
+    return length;
+}
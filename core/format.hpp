@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+// Longest anything below can produce: 64 binary digits
+#define FORMAT_MAX_DIGITS 64
+
+// Writes the decimal digits of `value` to `out`, and returns how many
+// there were. Zero is "0".
+size_t format_dec(char* out, uint64_t value);
+
+// Writes the hex digits of `value` to `out` without leading zeros, and
+// returns how many there were. Zero is "0".
+size_t format_hex(char* out, uint64_t value);
+
+// Writes the digits of `value` in any base from 2 to 16. This is the
+// slow path for bases that aren't 10 or 16.
+size_t format_radix(char* out, uint64_t value, uint8_t base);
+
+// How to print one integer in a klog call. Build these with hex(),
+// dec(), udec() or radix(), like klog(hex(addr, 16), " ", dec(n, 4)).
+struct IntFormat {
+    uint64_t magnitude;
+    bool negative;
+    uint8_t base;
+    // Digits are padded on the left with `pad` up to this many
+    uint8_t width;
+    char pad;
+};
+
+inline IntFormat hex(uint64_t value, uint8_t width = 0, char pad = '0') {
+    return {value, false, 16, width, pad};
+}
+
+inline IntFormat dec(int64_t value, uint8_t width = 0, char pad = ' ') {
+    // Negating as unsigned keeps INT64_MIN intact
+    auto magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+    return {magnitude, value < 0, 10, width, pad};
+}
+
+inline IntFormat udec(uint64_t value, uint8_t width = 0, char pad = ' ') {
+    return {value, false, 10, width, pad};
+}
+
+inline IntFormat radix(uint64_t value, uint8_t base, uint8_t width = 0, char pad = '0') {
+    return {value, false, base, width, pad};
+}
+
+// Times format_dec and format_hex against the old digit-at-a-time
+// loops, and logs the cycles per value for each
+void format_benchmark();
@@ -0,0 +1,104 @@
+#include "format.hpp"
+#include "logging.hpp"
+#include "cpu.hpp"
+
+// Values formatted per run of each benchmark
+#define BENCH_ITERATIONS 100000
+
+namespace {
+
+// What LogRecord used to do, kept here as the baseline. These print
+// every leading zero nybble, and nothing at all for zero.
+struct LegacyBuffer {
+    char text[LOG_RECORD_MAX];
+    size_t length;
+
+    void put(char c) {
+        if (length < LOG_RECORD_MAX) {
+            text[length++] = c;
+        }
+    }
+};
+
+const char* legacy_nybbles = "0123456789ABCDEF";
+
+void legacy_write(LegacyBuffer& b, uint64_t u) {
+    int shift = 64 - 4;
+    b.put('0');
+    b.put('x');
+    while(shift >= 0) {
+        uint64_t mask = 0xf;
+        mask <<= shift;
+        uint64_t nybble = (u & mask) >> shift;
+        shift -= 4;
+        b.put(legacy_nybbles[nybble]);
+    }
+}
+
+void legacy_write(LegacyBuffer& b, int64_t i) {
+    int64_t rev = 0;
+    uint64_t digits = 0;
+    if (i < 0) {
+        b.put('-');
+        i = 0 - i;
+    }
+    while(i) {
+        auto v = i % 10;
+        rev *= 10;
+        rev += v;
+        i /= 10;
+        digits++;
+    }
+    while(digits) {
+        auto v = rev % 10;
+        b.put('0'+v);
+        rev /= 10;
+        digits--;
+    }
+}
+
+// A spread of small and large values, so neither side only ever sees
+// its best case
+uint64_t bench_value(uint64_t i) {
+    return (i * 0x9e3779b97f4a7c15) >> (i % 64);
+}
+
+template <typename F>
+uint64_t cycles_per_value(F format) {
+    auto start = rdtsc();
+    for (uint64_t i = 0; i < BENCH_ITERATIONS; ++i) {
+        format(bench_value(i));
+    }
+    return (rdtsc() - start) / BENCH_ITERATIONS;
+}
+
+}
+
+void format_benchmark() {
+    LegacyBuffer legacy;
+    char out[FORMAT_MAX_DIGITS];
+
+    // The empty asm keeps the output from being optimised away
+    auto legacy_hex = cycles_per_value([&](uint64_t v) {
+        legacy.length = 0;
+        legacy_write(legacy, v);
+        asm volatile("" : : "r"(legacy.text) : "memory");
+    });
+    auto legacy_dec = cycles_per_value([&](uint64_t v) {
+        legacy.length = 0;
+        legacy_write(legacy, static_cast<int64_t>(v >> 1));
+        asm volatile("" : : "r"(legacy.text) : "memory");
+    });
+    auto fast_hex = cycles_per_value([&](uint64_t v) {
+        format_hex(out, v);
+        asm volatile("" : : "r"(out) : "memory");
+    });
+    auto fast_dec = cycles_per_value([&](uint64_t v) {
+        format_dec(out, v >> 1);
+        asm volatile("" : : "r"(out) : "memory");
+    });
+
+    klog("Format benchmark, cycles per value:\n");
+    klog("  hex: ", udec(legacy_hex, 5), " old, ", udec(fast_hex, 5), " new\n");
+    klog("  dec: ", udec(legacy_dec, 5), " old, ", udec(fast_dec, 5), " new\n");
+}
@@ -1,68 +1,260 @@
 #include "logging.hpp"
 #include "string.hpp"
 
-static const char* nybbles = "0123456789ABCDEF";
+// Start of the interned ktrace formats (see the linker script). A
+// format's ID is its offset from here.
+extern "C" const char ktrace_start[];
 
-Logger& Logger::global() {
-    static Logger logger;
-    if (logger.sink() == nullptr) {
-        logger.sink(Sink::global());
+// Binary trace frames on the wire start with this byte, which never
+// shows up in text. It's followed by the length of the rest of the
+// frame, then the CPU, the TSC and the record itself.
+#define TRACE_FRAME_MARKER 0xff
+
+PER_CPU Logger::Ring Logger::m_ring;
+
+__constinit Logger Logger::instance{};
+
+void Logger::init(Sink* sink) {
+    m_drain_lock.track("log drain");
+    m_sink = sink;
+}
+
+void Logger::commit(const LogRecord& record) {
+    commit(Kind::Text, record.text(), record.length());
+}
+
+void Logger::trace(const char* format, const uint64_t* args, size_t count) {
+    if (!m_binary_trace) {
+        LogRecord record;
+        size_t arg = 0;
+        for (auto c = format; *c; ++c) {
+            if (*c != '%' || c[1] == 0) {
+                record.put(*c);
+                continue;
+            }
+            ++c;
+            if (*c == '%' || arg == count) {
+                record.put(*c);
+            } else if (*c == 'x') {
+                record.write(args[arg++]);
+            } else if (*c == 'u') {
+                record.write(udec(args[arg++]));
+            } else {
+                record.write(static_cast<int64_t>(args[arg++]));
+            }
+        }
+        commit(record);
+        return;
+    }
+
+    // Format ID, argument count, then the arguments
+    char data[5 + TRACE_MAX_ARGS * 8];
+    uint32_t id = format - ktrace_start;
+    __builtin_memcpy(data, &id, 4);
+    data[4] = count;
+    for (size_t i = 0; i < count; ++i) {
+        __builtin_memcpy(data + 5 + i * 8, &args[i], 8);
+    }
+    commit(Kind::Trace, data, 5 + count * 8);
+}
+
+void Logger::commit(Kind kind, const char* data, size_t length) {
+    auto cpu = cpu_index();
+    auto& ring = this_cpu(m_ring);
+
+    // Nested commits from interrupt handlers just take the next slot.
+    // The slot is marked incomplete until everything is in, so drain
+    // never reads a half-written record.
+    auto pos = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+    auto& slot = ring.slots[pos % LOG_RING_SLOTS];
+    __atomic_store_n(&slot.seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot.tsc = rdtsc();
+    slot.cpu = cpu;
+    slot.kind = kind;
+    slot.length = length;
+    for (size_t i = 0; i < length; ++i) {
+        slot.text[i] = data[i];
+    }
+    __atomic_store_n(&slot.seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (!m_deferred) {
+        drain();
+        return;
+    }
+    // Pairs with the exchange in sleeping(): either the sleeper sees
+    // this record in pending(), or we see the sleeper
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    auto sleeper = __atomic_load_n(&m_sleeper, __ATOMIC_RELAXED);
+    if (sleeper && sleeper - 1 != cpu &&
+        __atomic_compare_exchange_n(&m_sleeper, &sleeper, 0, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        wake_cpu(sleeper - 1);
     }
-    return logger;
 }
 
-void Logger::write(const char* str) {
-    while (*str != 0) {
-        m_sink->writec(*str);
-        str++;
+bool Logger::pending() const {
+    for (unsigned cpu = 0; cpu < cpu_count(); ++cpu) {
+        auto& ring = per_cpu(m_ring, cpu);
+        if (__atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) != ring.tail) {
+            return true;
+        }
     }
+    return false;
 }
 
-void Logger::write(const String& str) {
-    write(str.str());
+void Logger::sleeping(bool asleep) {
+    __atomic_exchange_n(&m_sleeper, asleep ? cpu_index() + 1 : 0, __ATOMIC_SEQ_CST);
 }
 
-#define WRITE_U(s) void Logger::write(uint##s##_t u) { \
-        int shift = s - 4;                             \
-        m_sink->writec('0');                           \
-        m_sink->writec('x');                           \
-        while(shift >= 0) {                            \
-            uint##s##_t mask = 0xf;                    \
-            mask <<= shift;                            \
-            uint##s##_t nybble = (u & mask) >> shift;  \
-            shift -= 4;                                \
-            m_sink->writec(nybbles[nybble]);           \
-        }                                              \
+// Copies the oldest complete record of `ring` into `out`, skipping
+// over anything that's been overwritten. The record stays in the ring
+// until the caller moves the tail past it.
+bool Logger::peek(Ring& ring, Slot& out) {
+    while (true) {
+        auto head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+        auto pos = ring.tail;
+        if (pos == head) {
+            return false;
+        }
+        if (head - pos > LOG_RING_SLOTS) {
+            ring.dropped += head - LOG_RING_SLOTS - pos;
+            ring.tail = pos = head - LOG_RING_SLOTS;
+        }
+
+        auto& slot = ring.slots[pos % LOG_RING_SLOTS];
+        auto seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+        if (seq < pos + 1) {
+            // Still being written
+            return false;
+        }
+        if (seq == pos + 1) {
+            out.tsc = slot.tsc;
+            out.cpu = slot.cpu;
+            out.kind = slot.kind;
+            out.length = slot.length;
+            for (size_t i = 0; i < out.length; ++i) {
+                out.text[i] = slot.text[i];
+            }
+            // If the slot was reused while we copied, the copy is junk.
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == seq) {
+                return true;
+            }
+        }
+        ring.dropped++;
+        ring.tail = pos + 1;
     }
+}
 
-WRITE_U(8)
-WRITE_U(16)
-WRITE_U(32)
-WRITE_U(64)
-
-#define WRITE_I(s) void Logger::write(int##s##_t i) { \
-    int##s##_t rev = 0; \
-    uint64_t digits = 0; \
-    if (i < 0) { \
-        m_sink->writec('-'); \
-        i = 0 - i; \
-    } \
-    while(i) { \
-        auto v = i % 10; \
-        rev *= 10; \
-        rev += v; \
-        i /= 10; \
-        digits++; \
-    } \
-    while(digits) { \
-        auto v = rev % 10; \
-        m_sink->writec('0'+v); \
-        rev /= 10; \
-        digits--; \
-    } \
+size_t Logger::drain() {
+    if (!m_sink || !m_drain_lock.try_lock()) {
+        return 0;
+    }
+
+    size_t written = 0;
+    Slot record;
+    Slot candidate;
+    while (true) {
+        // Records within a CPU are already in order, so the oldest
+        // record overall is the oldest of each CPU's first.
+        Ring* oldest = nullptr;
+        for (unsigned cpu = 0; cpu < cpu_count(); ++cpu) {
+            auto& ring = per_cpu(m_ring, cpu);
+            if (__atomic_load_n(&ring.head, __ATOMIC_RELAXED) == ring.tail && !ring.dropped) {
+                continue;
+            }
+            if (ring.dropped) {
+                LogRecord note;
+                note.write("[");
+                note.write(udec(ring.dropped));
+                note.write(" log records dropped]\n");
+                m_sink->write(note.text(), note.length());
+                m_dropped += ring.dropped;
+                ring.dropped = 0;
+            }
+            if (peek(ring, candidate) && (!oldest || candidate.tsc < record.tsc)) {
+                oldest = &ring;
+                record.tsc = candidate.tsc;
+                record.cpu = candidate.cpu;
+                record.kind = candidate.kind;
+                record.length = candidate.length;
+                for (size_t i = 0; i < candidate.length; ++i) {
+                    record.text[i] = candidate.text[i];
+                }
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+        oldest->tail++;
+        if (record.kind == Kind::Trace) {
+            write_trace_frame(record);
+        } else {
+            m_sink->write(record.text, record.length);
+        }
+        written++;
+    }
+    m_sink->flush();
+
+    m_drain_lock.unlock();
+    return written;
+}
+
+void Logger::write_trace_frame(const Slot& record) {
+    char frame[2 + 1 + 8 + LOG_RECORD_MAX];
+    frame[0] = static_cast<char>(TRACE_FRAME_MARKER);
+    frame[1] = 1 + 8 + record.length;
+    frame[2] = record.cpu;
+    __builtin_memcpy(frame + 3, &record.tsc, 8);
+    for (size_t i = 0; i < record.length; ++i) {
+        frame[11 + i] = record.text[i];
+    }
+    m_sink->write(frame, 11 + record.length);
+}
+
+void LogRecord::write(const char* str) {
+    put(str, strlen(str));
 }
 
-WRITE_I(8)
-WRITE_I(16)
-WRITE_I(32)
-WRITE_I(64)
+void LogRecord::write(const String& str) {
+    write(str.str());
+}
+
+void LogRecord::write(uint8_t u) { write(static_cast<uint64_t>(u)); }
+void LogRecord::write(uint16_t u) { write(static_cast<uint64_t>(u)); }
+void LogRecord::write(uint32_t u) { write(static_cast<uint64_t>(u)); }
+
+void LogRecord::write(uint64_t u) {
+    char digits[2 + FORMAT_MAX_DIGITS] = {'0', 'x'};
+    put(digits, 2 + format_hex(digits + 2, u));
+}
+
+void LogRecord::write(int8_t i) { write(static_cast<int64_t>(i)); }
+void LogRecord::write(int16_t i) { write(static_cast<int64_t>(i)); }
+void LogRecord::write(int32_t i) { write(static_cast<int64_t>(i)); }
+
+void LogRecord::write(int64_t i) {
+    write(dec(i));
+}
+
+void LogRecord::write(const IntFormat& format) {
+    char digits[FORMAT_MAX_DIGITS];
+    auto length = format_radix(digits, format.magnitude, format.base);
+
+    // Zero padding goes after the sign and the 0x, spaces before
+    bool zeros = format.pad == '0';
+    if (zeros && format.negative) {
+        put('-');
+    }
+    if (format.base == 16) {
+        put("0x", 2);
+    }
+    for (auto i = length + (!zeros && format.negative); i < format.width; ++i) {
+        put(format.pad);
+    }
+    if (!zeros && format.negative) {
+        put('-');
+    }
+    put(digits, length);
+}
@@ -2,6 +2,9 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "cpu.hpp"
+#include "spinlock.hpp"
+#include "format.hpp"
 
 class String;
 
@@ -9,16 +12,39 @@ class Sink {
 public:
     virtual void writec(char) = 0;
 
+    // Sinks that can take more than a byte at a time should override
+    // this. The default just calls writec for each byte.
+    virtual void write(const char* str, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            writec(str[i]);
+        }
+    }
+
+    // Called at the end of every drain. Sinks that batch up writes
+    // should send whatever they're holding.
+    virtual void flush() {}
+
     static Sink* global();
 };
 
-class Logger {
-public:
-    static Logger& global();
+// Longest message a single klog call can produce. Anything past this
+// is cut off.
+#define LOG_RECORD_MAX 108
 
-    Sink* sink() const { return m_sink; }
-    void sink(Sink* s) { m_sink = s; }
+// Records kept per CPU before the oldest are overwritten
+#define LOG_RING_SLOTS 64
+
+// Most arguments a single ktrace call can take, so a binary record
+// (a 4 byte format ID, a count, then 8 bytes per argument) fits in a
+// log slot
+#define TRACE_MAX_ARGS 12
 
+// The text of a single klog call. It's put together on the caller's
+// stack, then committed to the log in one go. Unsigned integers are
+// written as hex and signed ones as decimal; use hex(), dec() and
+// friends from format.hpp for anything else.
+class LogRecord {
+public:
     void write(const char*);
     void write(const String&);
     void write(uint8_t);
@@ -29,17 +55,146 @@ public:
     void write(int16_t);
     void write(int32_t);
     void write(int64_t);
+    void write(const IntFormat&);
+
+    const char* text() const { return m_text; }
+    size_t length() const { return m_length; }
+
+    void put(char c) {
+        if (m_length < LOG_RECORD_MAX) {
+            m_text[m_length++] = c;
+        }
+    }
+
+    void put(const char* str, size_t length) {
+        if (length > LOG_RECORD_MAX - m_length) {
+            length = LOG_RECORD_MAX - m_length;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            m_text[m_length + i] = str[i];
+        }
+        m_length += length;
+    }
+
 private:
+    char m_text[LOG_RECORD_MAX];
+    size_t m_length = 0;
+};
+
+// klog doesn't touch the sink. Each CPU has a ring of records that
+// klog commits to without taking any locks, tagged with the CPU and
+// the TSC. drain() writes them out to the sink, oldest first across
+// all CPUs. If a CPU logs faster than its ring is drained, its oldest
+// records are overwritten, and drain() reports how many were lost.
+class Logger {
+public:
+    // Constant-initialized, so klog reaches it directly, without a
+    // guard check
+    static Logger& global() { return instance; }
+
+    // Gives the logger its first sink, in kinit's init phase. Records
+    // committed before then wait in the rings.
+    void init(Sink* sink);
+
+    Sink* sink() const { return m_sink; }
+    void sink(Sink* s) { m_sink = s; }
+
+    void commit(const LogRecord& record);
+
+    // Commits a ktrace call. In binary mode this is just the format's
+    // ID and the raw arguments; otherwise the format is rendered here,
+    // like klog.
+    void trace(const char* format, const uint64_t* args, size_t count);
+
+    // Switches ktrace between text and binary records. Binary records
+    // go out to the sink as frames that tools/ktrace_decode.py turns
+    // back into text with the kernel ELF. It's off by default, so
+    // early boot output is readable without the decoder.
+    void binary_trace(bool binary) { m_binary_trace = binary; }
+
+    // Writes every committed record to the sink, and returns how many
+    // there were. Safe to call from anywhere: if another drain is
+    // already running, this returns straight away.
+    size_t drain();
+
+    // Until this is set, every commit drains straight away, so nothing
+    // is lost if we crash during boot.
+    void deferred(bool deferred) { m_deferred = deferred; }
+
+    // Total records lost to overflow so far
+    uint64_t dropped() const { return m_dropped; }
+
+    // Whether any CPU has records drain() hasn't written out yet
+    bool pending() const;
+
+    // The CPU that drains the log marks itself asleep, with interrupts
+    // disabled, before its last pending() check and halt. A commit on
+    // any other CPU then wakes it with wake_cpu, so no record is left
+    // stranded until some unrelated interrupt comes along.
+    void sleeping(bool asleep);
+
+private:
+    enum class Kind : uint8_t {
+        Text,
+        Trace,
+    };
+
+    struct Slot {
+        // Position in the ring + 1 once the record is complete, 0
+        // while it's being written
+        uint64_t seq;
+        uint64_t tsc;
+        uint8_t cpu;
+        Kind kind;
+        uint16_t length;
+        char text[LOG_RECORD_MAX];
+    };
+    static_assert(sizeof(Slot) == 128, "Log slots should stay two cache lines");
+
+    struct Ring {
+        Slot slots[LOG_RING_SLOTS];
+        // Records ever reserved, and ever consumed (or dropped)
+        uint64_t head;
+        uint64_t tail;
+        uint64_t dropped;
+    };
+
+    static Logger instance;
+    static PER_CPU Ring m_ring;
     Sink* m_sink;
+    TicketLock m_drain_lock;
+    bool m_deferred;
+    bool m_binary_trace;
+    uint64_t m_dropped;
+    // Index + 1 of the CPU asleep in sleeping(), or 0
+    uint32_t m_sleeper;
+
+    void commit(Kind kind, const char* data, size_t length);
+    bool peek(Ring& ring, Slot& out);
+    void write_trace_frame(const Slot& record);
 };
 
-template <typename T>
-inline void klog(T& value) {
-    Logger::global().write(value);
+template <typename ... Ts>
+inline void klog(Ts... values) {
+    LogRecord record;
+    (record.write(values), ...);
+    Logger::global().commit(record);
 }
 
-template <typename T0, typename T1, typename ... Ts>
-inline void klog(T0 value, T1 next, Ts... rest) {
-    Logger::global().write(value);
-    klog(next, rest...);
+// Logs a record whose format is interned in the .ktrace section, so
+// in binary mode only an ID for it goes out. `fmt` must be a string
+// literal and every argument must be an integer. The format takes %x,
+// %d and %u (all 64 bit), and %% for a literal %.
+#define ktrace(fmt, ...) do {                                            \
+        static const char ktrace_format[]                                \
+            __attribute__((section(".ktrace.formats"), used)) = fmt;     \
+        ktrace_emit(ktrace_format, ##__VA_ARGS__);                       \
+    } while (0)
+
+template <typename ... Ts>
+inline void ktrace_emit(const char* format, Ts... values) {
+    static_assert(sizeof...(Ts) <= TRACE_MAX_ARGS, "Too many ktrace arguments");
+    // The extra zero keeps the array from being empty
+    uint64_t args[] = {static_cast<uint64_t>(values)..., 0};
+    Logger::global().trace(format, args, sizeof...(Ts));
 }
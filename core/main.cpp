@@ -1,6 +1,80 @@
 #include "boot_information.hpp"
 #include "logging.hpp"
+#include "page_allocator.hpp"
+#include "cpu.hpp"
+#include "interrupts.hpp"
+#include "paging.hpp"
+#include "string.hpp"
+#include "format.hpp"
+
+// Pages zeroed per pass of the idle loop
+#define IDLE_ZERO_BATCH 16
+
+// Background work for when there's nothing else to do. With
+// `report_locks` or `report_irqs`, the lock or interrupt stats are
+// logged once there's no zeroing left, which is about when boot has
+// settled down.
+static void idle(bool report_locks, bool report_irqs) {
+    while (true) {
+        Logger::global().drain();
+        if (PageAllocator::global().zero_idle(IDLE_ZERO_BATCH) == 0) {
+            if (report_locks || report_irqs) {
+                if (report_locks) {
+                    dump_lock_stats();
+                }
+                if (report_irqs) {
+                    dump_interrupt_stats();
+                }
+                report_locks = report_irqs = false;
+                continue;
+            }
+            // Interrupts stay off from the last check to the hlt, so a
+            // record committed in between either shows up in pending()
+            // or wakes us
+            disable_interrupts();
+            Logger::global().sleeping(true);
+            if (Logger::global().pending()) {
+                enable_interrupts();
+            } else {
+                enable_interrupts_and_halt();
+            }
+            Logger::global().sleeping(false);
+        }
+    }
+}
+
+// Where application processors end up once they're running. There's
+// nothing for them to do yet but help zero pages. Their log records
+// are written out by the boot CPU's idle loop, so the sinks only ever
+// have the one writer; a commit wakes it if it's asleep.
+extern "C" void ap_main(unsigned) {
+    enable_interrupts();
+    while (true) {
+        if (PageAllocator::global().zero_idle(IDLE_ZERO_BATCH) == 0) {
+            halt();
+        }
+    }
+}
 
 extern "C" void kmain(const BootInfo* boot_info) {
     klog(boot_info->cmdline, "\n");
+    if (cmdline_option(boot_info->cmdline.str(), "fmtbench")) {
+        format_benchmark();
+    }
+    if (cmdline_option(boot_info->cmdline.str(), "pagecheck")) {
+        check_clone_kernel_half();
+    }
+    // From here on, logging just fills the per-CPU rings and the idle
+    // loop writes them out.
+    Logger::global().deferred(true);
+    // `ktrace` on the command line sends ktrace records out as binary
+    // frames, for tools/ktrace_decode.py
+    if (cmdline_option(boot_info->cmdline.str(), "ktrace")) {
+        Logger::global().binary_trace(true);
+    }
+    ktrace("kmain: reached at tsc %u\n", rdtsc());
+    // `irqstats` reports how often each vector fired, and how long its
+    // handlers took
+    idle(cmdline_option(boot_info->cmdline.str(), "lockstats"),
+         cmdline_option(boot_info->cmdline.str(), "irqstats"));
 }
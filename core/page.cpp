@@ -0,0 +1,65 @@
+#include "page.hpp"
+#include "page_allocator.hpp"
+#include "demand_paging.hpp"
+#include "paging.hpp"
+#include "logging.hpp"
+
+Page* PageDatabase::frames = nullptr;
+size_t PageDatabase::frame_count = 0;
+
+// Entries covered by init(), whether or not they're backed yet
+static size_t capacity = 0;
+
+static void fill_reserved(void* page) {
+    auto entries = (Page*)page;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(Page); ++i) {
+        entries[i] = {0, PAGE_RESERVED, 0, PageOwner::None, 0};
+    }
+}
+
+bool PageDatabase::init(uintptr_t max_addr) {
+    auto count = (max_addr + PAGE_MASK) >> PAGE_SHIFT;
+    auto bytes = (count * sizeof(Page) + PAGE_MASK) & ~PAGE_MASK;
+    if (bytes > PAGE_DATABASE_END - PAGE_DATABASE_START) {
+        klog("Too much memory for the page database\n");
+        return false;
+    }
+    if (!DemandPaging::global().reserve("page database", PAGE_DATABASE_START, bytes,
+                                        PageOwner::PageDatabase, fill_reserved)) {
+        return false;
+    }
+    capacity = count;
+    return true;
+}
+
+void PageDatabase::populate(uintptr_t start, size_t size) {
+    auto first = start >> PAGE_SHIFT;
+    auto last = (start + size + PAGE_MASK) >> PAGE_SHIFT;
+    if (last > capacity) {
+        last = capacity;
+    }
+    if (first >= last) {
+        return;
+    }
+    auto table = (Page*)PAGE_DATABASE_START;
+    if (!DemandPaging::global().populate((uintptr_t)&table[first], (last - first) * sizeof(Page))) {
+        klog("Could not populate the page database for ", start, ":", start + size, "\n");
+    }
+}
+
+void PageDatabase::activate() {
+    auto& pages = PageAllocator::global();
+    auto table = (Page*)PAGE_DATABASE_START;
+
+    // Everything sitting on a free list is, by definition, managed
+    // by the page allocator.
+    pages.for_each_free([&](size_t pfn, unsigned order) {
+        for (size_t i = 0; i < (1ul << order) && pfn + i < capacity; ++i) {
+            table[pfn + i].flags = 0;
+        }
+    });
+
+    frames = table;
+    frame_count = capacity;
+    klog("Page database: ", capacity, " frames at ", (uintptr_t)table, "\n");
+}
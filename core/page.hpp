@@ -0,0 +1,72 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "kmemlayout.h"
+
+// Who a frame belongs to. Purely informational for now, but it lets
+// dumps and sanity checks make sense of physical memory.
+enum class PageOwner : uint8_t {
+    None,
+    Heap,
+    PageTable,
+    PageDatabase,
+};
+
+// Not managed by the page allocator (holes, firmware, the kernel
+// image, or memory taken before the database existed)
+#define PAGE_RESERVED 0x0001
+// First frame of an allocated block. `order` is only valid on these.
+#define PAGE_HEAD 0x0002
+// Known to be all zeroes
+#define PAGE_ZEROED 0x0004
+
+// Per-frame metadata, one per physical page. Kept to 16 bytes so four
+// share a cache line, with the fields touched on every alloc/free up
+// front.
+struct Page {
+    uint32_t refcount;
+    uint16_t flags;
+    uint8_t order;
+    PageOwner owner;
+    // Free for the owner to use
+    uint64_t priv;
+};
+static_assert(sizeof(Page) == 16, "Page should stay 16 bytes");
+
+// The database covers every frame below the highest address of memory,
+// but lives in a demand paged region: entries for holes in the memory
+// map cost nothing until something looks at them, and then read as
+// reserved.
+namespace PageDatabase {
+    // Reserves room for entries covering every frame below max_addr.
+    bool init(uintptr_t max_addr);
+
+    // Backs the entries for the frames in [start, start + size). The
+    // page allocator can't take a fault on the database, so every
+    // range it manages has to be populated before activate().
+    void populate(uintptr_t start, size_t size);
+
+    // Marks the frames on the allocator's free lists as free, and
+    // makes the database visible to phys_to_page.
+    void activate();
+
+    // Set up by activate(). Until then, frame_count is zero.
+    extern Page* frames;
+    extern size_t frame_count;
+}
+
+inline Page* pfn_to_page(size_t pfn) {
+    return &PageDatabase::frames[pfn];
+}
+
+inline size_t page_to_pfn(const Page* page) {
+    return page - PageDatabase::frames;
+}
+
+// Like pfn_to_page, but returns nullptr for frames the database
+// doesn't cover (including everything, before it's initialized).
+inline Page* phys_to_page(uintptr_t phys) {
+    auto pfn = phys >> PAGE_SHIFT;
+    return pfn < PageDatabase::frame_count ? pfn_to_page(pfn) : nullptr;
+}
@@ -1,186 +1,561 @@
 #include "page_allocator.hpp"
 #include "logging.hpp"
 #include "kmemlayout.h"
+#include "paging.hpp"
+#include "page.hpp"
 
-PageAllocator& PageAllocator::global() {
-    static PageAllocator instance;
-    return instance;
+__constinit PageAllocator PageAllocator::instance{};
+
+PER_CPU PageAllocator::FrameCache PageAllocator::m_cache;
+
+unsigned PageAllocator::order_for(size_t size) {
+    unsigned order = 0;
+    while (((size_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
 }
 
 void PageAllocator::add_region(uintptr_t start, size_t size) {
-    uintptr_t huge_start = start;
-    uintptr_t huge_end = start + size;
-    uintptr_t big_start = start;
-    uintptr_t big_end = start + size;
-    uintptr_t end = start + size;
-
-    // align huge section start/end
-    if (huge_start & HUGE_PAGE_MASK) {
-        huge_start += HUGE_PAGE_SIZE;
-        huge_start &= ~HUGE_PAGE_MASK;
-    }
-    huge_end &= ~HUGE_PAGE_MASK;
-
-    // align big section start/end
-    if (big_start & BIG_PAGE_MASK) {
-        big_start += BIG_PAGE_SIZE;
-        big_start &= ~BIG_PAGE_MASK;
-    }
-    big_end &= ~BIG_PAGE_MASK;
-
-    // align page section start/end
-    if (start & PAGE_MASK) {
-        start += PAGE_SIZE;
-        start &= ~PAGE_MASK;
-    }
-    end &= ~PAGE_MASK;
-
-    // If there's a huge-aliged section of this region, we can add it first
-    if (huge_start < huge_end) {
-        add_chunk(m_huge_chunks, huge_start, huge_end-huge_start);
-
-        // We now need to check if we have any big/normal regions on
-        // the edges of the huge region.
-        if (big_start < huge_start) {
-            add_chunk(m_big_chunks, big_start, huge_start - big_start);
-            if (start < big_start) {
-                add_chunk(m_chunks, start, big_start - start);
-            }
-        } else {
-            if (start < huge_start) {
-                add_chunk(m_chunks, start, huge_start - start);
-            }
+    auto end = (start + size) & ~PAGE_MASK;
+    start = (start + PAGE_MASK) & ~PAGE_MASK;
+    if (start >= end) {
+        return;
+    }
+
+    // Once we're up and running, anything below the physical window
+    // can go straight onto the free lists.
+    if (m_initialized) {
+        if (start < PhysicalWindow::size) {
+            auto window_end = end < PhysicalWindow::size ? end : PhysicalWindow::size;
+            free_range(start, window_end);
+            start = window_end;
+        }
+        if (start >= end) {
+            return;
         }
+    }
 
-        if (big_end > huge_end) {
-            add_chunk(m_big_chunks, huge_end, big_end - huge_end);
-            if (end > big_end) {
-                add_chunk(m_chunks, big_end, end - big_end);
-            }
+    // Keep the ranges sorted by address, merging any that touch.
+    size_t i = 0;
+    while (i < m_range_count && m_ranges[i].start + m_ranges[i].size < start) {
+        i++;
+    }
+    if (i < m_range_count && m_ranges[i].start + m_ranges[i].size == start) {
+        m_ranges[i].size += end - start;
+        if (i + 1 < m_range_count && m_ranges[i + 1].start == end) {
+            m_ranges[i].size += m_ranges[i + 1].size;
+            remove_range(i + 1);
+        }
+        return;
+    }
+    if (i < m_range_count && m_ranges[i].start == end) {
+        m_ranges[i].start = start;
+        m_ranges[i].size += end - start;
+        return;
+    }
+    insert_range(i, start, end - start);
+}
+
+void PageAllocator::reserve_region(uintptr_t start, size_t size) {
+    if (m_initialized) {
+        klog("Can't reserve memory after the page allocator is initialized\n");
+        return;
+    }
+
+    auto end = (start + size + PAGE_MASK) & ~PAGE_MASK;
+    start &= ~PAGE_MASK;
+
+    // Trim every range that overlaps the reserved region. The ranges
+    // never overlap each other, so at most one of them can need
+    // splitting.
+    size_t i = 0;
+    while (i < m_range_count) {
+        auto range_start = m_ranges[i].start;
+        auto range_end = range_start + m_ranges[i].size;
+        if (range_end <= start || range_start >= end) {
+            i++;
+            continue;
+        }
+        if (start <= range_start && end >= range_end) {
+            remove_range(i);
+            continue;
+        }
+        if (start > range_start && end < range_end) {
+            m_ranges[i].size = start - range_start;
+            insert_range(i + 1, end, range_end - end);
+            return;
+        }
+        if (start <= range_start) {
+            m_ranges[i].start = end;
+            m_ranges[i].size = range_end - end;
         } else {
-            if (end > huge_end) {
-                add_chunk(m_chunks, end, end - huge_end);
+            m_ranges[i].size = start - range_start;
+        }
+        i++;
+    }
+}
+
+void PageAllocator::init() {
+    m_lock.track("page allocator");
+    m_zero_lock.track("zeroed pages");
+    if (m_range_count == 0) {
+        klog("No usable memory for the page allocator\n");
+        return;
+    }
+    auto& last = m_ranges[m_range_count - 1];
+    m_max_pfn = (last.start + last.size) >> PAGE_SHIFT;
+
+    size_t words[MAX_ORDER + 1];
+    size_t total_words = 0;
+    for (unsigned order = 0; order <= MAX_ORDER; ++order) {
+        words[order] = ((m_max_pfn >> order) + 64) / 64;
+        total_words += words[order];
+    }
+    auto bytes = (total_words * sizeof(uint64_t) + PAGE_MASK) & ~PAGE_MASK;
+
+    // The bitmaps come out of the first range that can hold them.
+    uintptr_t storage = 0;
+    for (size_t i = 0; i < m_range_count; ++i) {
+        if (m_ranges[i].size >= bytes && m_ranges[i].start + bytes <= PhysicalWindow::size) {
+            storage = m_ranges[i].start;
+            m_ranges[i].start += bytes;
+            m_ranges[i].size -= bytes;
+            if (m_ranges[i].size == 0) {
+                remove_range(i);
             }
+            break;
         }
-    } else if (big_start < big_end) {
-        add_chunk(m_big_chunks, big_start, big_end - big_start);
+    }
+    if (!storage) {
+        klog("Not enough memory for the page allocator bitmaps\n");
+        return;
+    }
 
-        if (end > big_end) {
-            add_chunk(m_chunks, big_end, end - big_end);
+    if (m_tuning.high == 0) {
+        cache_tuning({32, 96, 32});
+    }
+    if (m_zero_target == 0) {
+        m_zero_target = 256;
+    }
+
+    auto bitmap = phys_to_virt<uint64_t>(storage);
+    for (size_t i = 0; i < total_words; ++i) {
+        bitmap[i] = 0;
+    }
+    for (unsigned order = 0; order <= MAX_ORDER; ++order) {
+        m_bitmaps[order] = bitmap;
+        bitmap += words[order];
+    }
+    m_initialized = true;
+
+    // Hand everything we can reach over to the buddy lists. Memory
+    // above the physical window stays in m_ranges until we have a
+    // way to touch it.
+    size_t i = 0;
+    while (i < m_range_count) {
+        auto start = m_ranges[i].start;
+        auto end = start + m_ranges[i].size;
+        if (start >= PhysicalWindow::size) {
+            i++;
+            continue;
+        }
+        if (end > PhysicalWindow::size) {
+            free_range(start, PhysicalWindow::size);
+            m_ranges[i].start = PhysicalWindow::size;
+            m_ranges[i].size = end - PhysicalWindow::size;
+            i++;
+            continue;
+        }
+        free_range(start, end);
+        remove_range(i);
+    }
+    if (m_range_count) {
+        size_t unreachable = 0;
+        for (size_t i = 0; i < m_range_count; ++i) {
+            unreachable += m_ranges[i].size;
         }
+        klog("Holding back ", unreachable, " bytes above the physical window\n");
+    }
+}
 
-        if (start < big_start) {
-            add_chunk(m_chunks, start, big_start - start);
+uintptr_t PageAllocator::alloc_order(unsigned order) {
+    if (!m_initialized) {
+        return alloc_early(order);
+    }
+
+    uintptr_t addr;
+    if (order == 0) {
+        addr = cache_alloc();
+        // Zeroed pages are still free pages, so use them before
+        // giving up.
+        if (!addr) {
+            addr = take_zeroed();
         }
-    } else if (start < end) {
-        add_chunk(m_chunks, start, end - start);
+    } else {
+        IrqSaveGuard<McsLock> guard(m_lock);
+        addr = alloc_block(order);
+    }
+
+    auto pfn = addr >> PAGE_SHIFT;
+    if (addr && pfn < PageDatabase::frame_count) {
+        *pfn_to_page(pfn) = {1, PAGE_HEAD, (uint8_t)order, PageOwner::None, 0};
     }
+    return addr;
 }
 
-void PageAllocator::add_chunk(List<PageChunk>& chunks, uintptr_t start, size_t size) {
-    uintptr_t end = start + size;
+void PageAllocator::free(uintptr_t addr, unsigned order) {
+    if (!check_free(addr, order)) {
+        return;
+    }
+    if (order == 0) {
+        cache_free(addr, false);
+        return;
+    }
+    IrqSaveGuard<McsLock> guard(m_lock);
+    free_block(addr >> PAGE_SHIFT, order);
+}
 
-    // TODO: lock the page allocator for multi-cpu safety
-    auto chunk = chunks.begin();
-    for (; chunk != chunks.end(); ++chunk) {
-        // If we belong directly after this chunk, we'll remove it
-        // from the list and update our start, size, and end. The next
-        // iterator step will re-insert us in the right place - either
-        // merging with the next chunk if we span the gap, or
-        // inserting us just before it
-        if (chunk->start + chunk->size == start) {
-            start = chunk->start;
-            size += chunk->size;
-            chunk.remove();
-            continue;
+void PageAllocator::free_cold(uintptr_t addr) {
+    if (check_free(addr, 0)) {
+        cache_free(addr, true);
+    }
+}
+
+uintptr_t PageAllocator::alloc_early(unsigned order) {
+    // Before init(), blocks are carved straight out of the boot
+    // ranges. They're never handed to the buddy lists, so the page
+    // database will see them as reserved.
+    auto size = (size_t)PAGE_SIZE << order;
+    for (size_t i = 0; i < m_range_count; ++i) {
+        auto start = (m_ranges[i].start + size - 1) & ~(size - 1);
+        auto end = m_ranges[i].start + m_ranges[i].size;
+        if (start + size <= end && start + size <= PhysicalWindow::size) {
+            reserve_region(start, size);
+            return start;
         }
+    }
+    return 0;
+}
 
-        // If we belong directly before this chunk, update the start+size;
-        if (end == chunk->start) {
-            chunk->start = start;
-            chunk->size = size + chunk->size;
-            return;
+uintptr_t PageAllocator::alloc_zeroed() {
+    if (auto addr = take_zeroed()) {
+        __atomic_fetch_add(&m_zero_hits, 1, __ATOMIC_RELAXED);
+        *pfn_to_page(addr >> PAGE_SHIFT) = {1, PAGE_HEAD, 0, PageOwner::None, 0};
+        return addr;
+    }
+    __atomic_fetch_add(&m_zero_misses, 1, __ATOMIC_RELAXED);
+    auto addr = alloc_order(0);
+    if (addr) {
+        zero_page(phys_to_virt(addr));
+    }
+    return addr;
+}
+
+void PageAllocator::free_zeroed(uintptr_t addr) {
+    if (!check_free(addr, 0)) {
+        return;
+    }
+    if ((addr >> PAGE_SHIFT) >= PageDatabase::frame_count) {
+        cache_free(addr, false);
+        return;
+    }
+    put_zeroed(addr >> PAGE_SHIFT);
+}
+
+void PageAllocator::share(uintptr_t addr) {
+    auto page = phys_to_page(addr);
+    if (page && !(page->flags & PAGE_RESERVED)) {
+        __atomic_fetch_add(&page->refcount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void PageAllocator::release(uintptr_t addr, unsigned order) {
+    auto page = phys_to_page(addr);
+    if (!page || (page->flags & PAGE_RESERVED)) {
+        return;
+    }
+    if (__atomic_fetch_sub(&page->refcount, 1, __ATOMIC_ACQ_REL) == 1) {
+        // Nobody else can see the block now. check_free expects to
+        // find the reference we're giving up.
+        page->refcount = 1;
+        free(addr, order);
+    }
+}
+
+size_t PageAllocator::zero_idle(size_t budget) {
+    if (!PageDatabase::frame_count) {
+        return 0;
+    }
+    size_t zeroed = 0;
+    while (zeroed < budget && m_zero_count < m_zero_target) {
+        // Take pages straight from the buddy lists rather than the
+        // per-CPU cache, which holds the pages most likely to still
+        // be in the CPU cache.
+        uintptr_t addr;
+        {
+            IrqSaveGuard<McsLock> guard(m_lock);
+            addr = alloc_block(0);
+        }
+        if (!addr) {
+            break;
         }
+        zero_page_nt(phys_to_virt(addr));
+        put_zeroed(addr >> PAGE_SHIFT);
+        zeroed++;
+    }
+    return zeroed;
+}
+
+uintptr_t PageAllocator::take_zeroed() {
+    IrqSaveGuard<TicketLock> guard(m_zero_lock);
+    if (!m_zero_head) {
+        return 0;
+    }
+    auto pfn = m_zero_head;
+    m_zero_head = pfn_to_page(pfn)->priv;
+    m_zero_count--;
+    return pfn << PAGE_SHIFT;
+}
 
-        // If we are entirely before this chunk, insert ourselves into
-        // the list here.
-        if (end < chunk->start) {
+void PageAllocator::put_zeroed(size_t pfn) {
+    IrqSaveGuard<TicketLock> guard(m_zero_lock);
+    *pfn_to_page(pfn) = {0, PAGE_ZEROED, 0, PageOwner::None, m_zero_head};
+    m_zero_head = pfn;
+    m_zero_count++;
+}
+
+void PageAllocator::cache_tuning(const CacheTuning& tuning) {
+    m_tuning = tuning;
+    if (m_tuning.high > FRAME_CACHE_SIZE) {
+        m_tuning.high = FRAME_CACHE_SIZE;
+    }
+    if (m_tuning.low > m_tuning.high) {
+        m_tuning.low = m_tuning.high;
+    }
+    if (m_tuning.batch > m_tuning.high) {
+        m_tuning.batch = m_tuning.high;
+    }
+}
+
+bool PageAllocator::check_free(uintptr_t addr, unsigned order) {
+    auto pfn = addr >> PAGE_SHIFT;
+    if (order > MAX_ORDER || (addr & PAGE_MASK) || (pfn & ((1ul << order) - 1)) || pfn >= m_max_pfn) {
+        klog("Tried to free a bad page block ", addr, "\n");
+        return false;
+    }
+    if (pfn < PageDatabase::frame_count) {
+        auto page = pfn_to_page(pfn);
+        if (page->refcount == 0 && !(page->flags & PAGE_RESERVED)) {
+            klog("Tried to free an already free page block ", addr, "\n");
+            return false;
+        }
+        if ((page->flags & PAGE_HEAD) && page->order != order) {
+            klog("Freeing page block ", addr, " with the wrong order\n");
+        }
+        *page = {0, 0, 0, PageOwner::None, 0};
+    }
+    return true;
+}
+
+uintptr_t PageAllocator::cache_alloc() {
+    // An interrupt handler allocating in the middle of this would
+    // corrupt count and bottom
+    InterruptGuard interrupts;
+    auto& cache = this_cpu(m_cache);
+    if (cache.count == 0) {
+        cache.misses++;
+        refill(cache);
+        if (cache.count == 0) {
+            return 0;
+        }
+    } else {
+        cache.hits++;
+    }
+    cache.count--;
+    return cache.frames[(cache.bottom + cache.count) % FRAME_CACHE_SIZE];
+}
+
+void PageAllocator::cache_free(uintptr_t addr, bool cold) {
+    InterruptGuard interrupts;
+    auto& cache = this_cpu(m_cache);
+    if (cache.count >= m_tuning.high) {
+        drain(cache);
+    }
+    if (cold) {
+        cache.bottom = (cache.bottom + FRAME_CACHE_SIZE - 1) % FRAME_CACHE_SIZE;
+        cache.frames[cache.bottom] = addr;
+    } else {
+        cache.frames[(cache.bottom + cache.count) % FRAME_CACHE_SIZE] = addr;
+    }
+    cache.count++;
+}
+
+void PageAllocator::refill(FrameCache& cache) {
+    IrqSaveGuard<McsLock> guard(m_lock);
+    cache.refills++;
+    while (cache.count < m_tuning.batch) {
+        auto addr = alloc_block(0);
+        if (!addr) {
             break;
         }
+        cache.frames[(cache.bottom + cache.count) % FRAME_CACHE_SIZE] = addr;
+        cache.count++;
     }
+}
 
-    // If we get here, we've either iterated through the entire list
-    // (and are adding ourselves to the end), or we broke where we
-    // belong.
-    chunk.insert({start, size});
+void PageAllocator::drain(FrameCache& cache) {
+    IrqSaveGuard<McsLock> guard(m_lock);
+    cache.drains++;
+    while (cache.count > m_tuning.low) {
+        free_block(cache.frames[cache.bottom] >> PAGE_SHIFT, 0);
+        cache.bottom = (cache.bottom + 1) % FRAME_CACHE_SIZE;
+        cache.count--;
+    }
 }
 
-void PageAllocator::reserve_region(uintptr_t start, size_t size) {
-    // For each type of chunk, we check for overlap with the
-    // region. If we find any, we trim the chunk, then re-add what's
-    // left
-    auto end = start + size;
-
-    auto trim_chunks = [&](List<PageChunk>& chunks) {
-        for(auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
-            auto chunk_end = chunk->start + chunk->size;
-            if (chunk->start >= end) {
-                // We've gone past any chunks this region would affect;
-                break;
-            }
-            if (chunk_end <= start) {
-                continue;
-            }
-            // If we get here it means that we have some overlap with the chunk
-        
-            if (start >= chunk->start && end <= chunk_end) {
-                // The reserved region is entirely contained within this chunk. Split it.
-                // Start by removing this chunk from the list
-                PageChunk self = *chunk;
-                chunk.remove();
-            
-                add_region(self.start, start - self.start);
-                add_region(end, chunk_end - end);
-                // Since we were entirely contained, we're done
-                break;
-            }
-            if (start < chunk->start) {
-                // The resserved region overlaps the start of this chunk.
-                chunk.remove();
-                add_region(end, chunk_end - end);
-                // We've hit the end of our reserved region, so we can
-                // break here.
-                break;
-            }
-            if (end > chunk_end) {
-                // The reserved region overlaps the end of this chunk
-                PageChunk self = *chunk;
-                chunk.remove();
-                add_region(self.start, start - self.start);
-                // We need to be sure the end doesn't overlap with the
-                // next region, so we continue here.
-                continue;
-            }
+uintptr_t PageAllocator::alloc_block(unsigned order) {
+    auto found = order;
+    while (found <= MAX_ORDER && !m_free[found]) {
+        found++;
+    }
+    if (found > MAX_ORDER) {
+        return 0;
+    }
+
+    auto pfn = virt_to_phys(m_free[found]) >> PAGE_SHIFT;
+    unlink(found, pfn);
+
+    // Split the block down to the requested size, putting the upper
+    // half back on the free list at each step.
+    while (found > order) {
+        found--;
+        push(found, pfn + (1ul << found));
+    }
+    return pfn << PAGE_SHIFT;
+}
+
+void PageAllocator::free_block(size_t pfn, unsigned order) {
+    if (test(order, pfn)) {
+        klog("Tried to free an already free page block ", pfn << PAGE_SHIFT, "\n");
+        return;
+    }
+
+    // Merge with our buddy for as long as it's free, moving up an
+    // order each time.
+    while (order < MAX_ORDER) {
+        auto buddy = pfn ^ (1ul << order);
+        if (buddy >= m_max_pfn || !test(order, buddy)) {
+            break;
         }
-    };
+        unlink(order, buddy);
+        pfn &= ~(1ul << order);
+        order++;
+    }
+    push(order, pfn);
+}
+
+uintptr_t PageAllocator::alloc(size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    return alloc_order(order_for(size));
+}
 
-    trim_chunks(m_huge_chunks);
-    trim_chunks(m_big_chunks);
-    trim_chunks(m_chunks);
+void PageAllocator::insert_range(size_t index, uintptr_t start, size_t size) {
+    if (m_range_count == MAX_RANGES) {
+        klog("Too many memory ranges, dropping ", start, ":", start+size, "\n");
+        return;
+    }
+    for (size_t i = m_range_count; i > index; --i) {
+        m_ranges[i] = m_ranges[i - 1];
+    }
+    m_ranges[index] = {start, size};
+    m_range_count++;
+}
+
+void PageAllocator::remove_range(size_t index) {
+    m_range_count--;
+    for (size_t i = index; i < m_range_count; ++i) {
+        m_ranges[i] = m_ranges[i + 1];
+    }
+}
+
+void PageAllocator::free_range(uintptr_t start, uintptr_t end) {
+    // Frames handed over after the page database exists need backed
+    // entries (we can't take a fault on them with the lock held), and
+    // need to be marked as ours.
+    if (PageDatabase::frame_count) {
+        PageDatabase::populate(start, end - start);
+    }
+    for (auto pfn = start >> PAGE_SHIFT; pfn < (end >> PAGE_SHIFT) && pfn < PageDatabase::frame_count; ++pfn) {
+        pfn_to_page(pfn)->flags &= ~PAGE_RESERVED;
+    }
+
+    // Free the range as the largest aligned blocks that fit.
+    IrqSaveGuard<McsLock> guard(m_lock);
+    while (start < end) {
+        unsigned order = MAX_ORDER;
+        while (order > 0 && ((start & (((size_t)PAGE_SIZE << order) - 1)) ||
+                             start + ((size_t)PAGE_SIZE << order) > end)) {
+            order--;
+        }
+        free_block(start >> PAGE_SHIFT, order);
+        start += (size_t)PAGE_SIZE << order;
+    }
+}
+
+bool PageAllocator::test(unsigned order, size_t pfn) const {
+    auto index = pfn >> order;
+    return m_bitmaps[order][index / 64] & (1ull << (index % 64));
+}
+
+void PageAllocator::push(unsigned order, size_t pfn) {
+    auto index = pfn >> order;
+    m_bitmaps[order][index / 64] |= 1ull << (index % 64);
+
+    auto block = phys_to_virt<FreeBlock>(pfn << PAGE_SHIFT);
+    block->prev = nullptr;
+    block->next = m_free[order];
+    if (m_free[order]) {
+        m_free[order]->prev = block;
+    }
+    m_free[order] = block;
+    m_free_count[order]++;
+}
+
+void PageAllocator::unlink(unsigned order, size_t pfn) {
+    auto index = pfn >> order;
+    m_bitmaps[order][index / 64] &= ~(1ull << (index % 64));
+
+    auto block = phys_to_virt<FreeBlock>(pfn << PAGE_SHIFT);
+    (block->prev ? block->prev->next : m_free[order]) = block->next;
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    m_free_count[order]--;
 }
 
 void PageAllocator::dump() const {
     klog("==Page Allocator==\n");
-    klog("*Huge Pages*\n");
-    for (auto& chunk : m_huge_chunks) {
-        klog(chunk.start, ":", chunk.start+chunk.size, "\n");
+    size_t total = 0;
+    for (unsigned order = 0; order <= MAX_ORDER; ++order) {
+        if (m_free_count[order]) {
+            klog("order ", (uint8_t)order, ": ", m_free_count[order], " free\n");
+        }
+        total += m_free_count[order] << order;
     }
-    klog("\n*Big Pages*\n");
-    for (auto& chunk : m_big_chunks) {
-        klog(chunk.start, ":", chunk.start+chunk.size, "\n");
+    klog("Free pages: ", total, "\n");
+    klog("Zeroed pool: ", m_zero_count, " pages, ", m_zero_hits, " hits, ", m_zero_misses, " misses\n");
+    for (unsigned cpu = 0; cpu < cpu_count(); ++cpu) {
+        auto& cache = per_cpu(m_cache, cpu);
+        if (cache.hits || cache.misses) {
+            klog("CPU ", (uint8_t)cpu, " cache: ", cache.count, " frames, ",
+                 cache.hits, " hits, ", cache.misses, " misses, ",
+                 cache.refills, " refills, ", cache.drains, " drains\n");
+        }
     }
-    klog("\n*Pages*\n");
-    for (auto& chunk : m_chunks) {
-        klog(chunk.start, ":", chunk.start+chunk.size, "\n");
+    for (size_t i = 0; i < m_range_count; ++i) {
+        klog("Unreachable: ", m_ranges[i].start, ":", m_ranges[i].start + m_ranges[i].size, "\n");
     }
 }
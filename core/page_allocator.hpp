@@ -2,27 +2,186 @@
 
 #include "stddef.h"
 #include "stdint.h"
-#include "list.hpp"
+#include "paging.hpp"
+#include "spinlock.hpp"
 
+// A binary buddy allocator for physical pages. Blocks range from a
+// single page (order 0) up to a huge page (MAX_ORDER).
+//
+// During boot, usable memory is described with add_region and
+// reserve_region, then handed over to the buddy lists by init(). Any
+// allocations before that are carved directly out of those regions
+// and can't be freed.
+//
+// Single pages are mostly served from small per-CPU caches, so the
+// common order-0 alloc/free takes no lock and touches no shared
+// cache lines. The caches refill from, and drain to, the buddy lists
+// in batches.
 class PageAllocator {
 public:
-    static PageAllocator& global();
+    static constexpr unsigned MAX_ORDER = 18;
+
+    // Constant-initialized, like Allocator's
+    static PageAllocator& global() { return instance; }
 
     void add_region(uintptr_t start, size_t size);
     void reserve_region(uintptr_t start, size_t size);
+    void init();
+
+    // Returns the physical address of a naturally-aligned block of
+    // 2^order pages, or 0 if there isn't one.
+    uintptr_t alloc_order(unsigned order);
+    void free(uintptr_t addr, unsigned order);
 
+    // Frees a single page that isn't likely to be in the CPU cache
+    // any more. It goes to the cold end of the per-CPU cache, so it's
+    // handed out last and drained first.
+    void free_cold(uintptr_t addr);
+
+    // Per-CPU cache watermarks. A cache that runs dry takes `batch`
+    // frames from the buddy lists; one that grows past `high` frames
+    // gives its coldest frames back until it's down to `low`.
+    struct CacheTuning {
+        size_t low;
+        size_t high;
+        size_t batch;
+    };
+    void cache_tuning(const CacheTuning& tuning);
+
+    // Like alloc_order, for the smallest order that holds `size`
+    // bytes.
     uintptr_t alloc(size_t size);
 
+    // Allocates a single page that's all zeroes. These come from a
+    // pool of pages zeroed ahead of time by zero_idle, and are only
+    // zeroed on the spot if the pool is empty.
+    uintptr_t alloc_zeroed();
+
+    // Frees a single page that the caller knows is still all zeroes
+    // (e.g. a page table with every entry cleared). It goes straight
+    // back into the zeroed pool.
+    void free_zeroed(uintptr_t addr);
+
+    // Reference counting for blocks mapped in more than one place.
+    // Blocks start out with one reference when they're allocated, and
+    // release() frees them once the last one is dropped. Frames the
+    // page database doesn't manage are left alone.
+    void share(uintptr_t addr);
+    void release(uintptr_t addr, unsigned order = 0);
+
+    // Zeroes up to `budget` free pages into the zeroed pool, stopping
+    // once the pool holds its target number of pages. Returns how
+    // many were zeroed. Meant to be called when there's nothing better
+    // to do.
+    size_t zero_idle(size_t budget);
+    void zero_pool_target(size_t pages) { m_zero_target = pages; }
+
+    static unsigned order_for(size_t size);
+
+    // Calls f(pfn, order) for every free block, including frames
+    // sitting in the per-CPU caches.
+    template <typename F>
+    void for_each_free(F f) const {
+        for (unsigned order = 0; order <= MAX_ORDER; ++order) {
+            for (auto block = m_free[order]; block; block = block->next) {
+                f(virt_to_phys(block) >> PAGE_SHIFT, order);
+            }
+        }
+        for (unsigned cpu = 0; cpu < cpu_count(); ++cpu) {
+            auto& cache = per_cpu(m_cache, cpu);
+            for (size_t i = 0; i < cache.count; ++i) {
+                f(cache.frames[(cache.bottom + i) % FRAME_CACHE_SIZE] >> PAGE_SHIFT, 0);
+            }
+        }
+    }
+
     void dump() const;
 private:
+    static PageAllocator instance;
+
     struct PageChunk {
         uintptr_t start;
         size_t size;
     };
 
-    List<PageChunk> m_huge_chunks;
-    List<PageChunk> m_big_chunks;
-    List<PageChunk> m_chunks;
+    // Free blocks are linked through their first few bytes, which we
+    // reach through the physical memory window.
+    struct FreeBlock {
+        FreeBlock* next;
+        FreeBlock* prev;
+    };
+
+    // Until init(), memory is tracked as a short list of
+    // ranges. Multiboot memory maps are small, so a fixed array is
+    // plenty and doesn't need the heap.
+    static constexpr size_t MAX_RANGES = 64;
+    PageChunk m_ranges[MAX_RANGES];
+    size_t m_range_count;
+    bool m_initialized;
+
+    // One bit per block for each order, set if that block is the
+    // head of a free block of exactly that order. This is what lets
+    // free() find out if a buddy can be merged in O(1).
+    uint64_t* m_bitmaps[MAX_ORDER + 1];
+    size_t m_max_pfn;
+
+    FreeBlock* m_free[MAX_ORDER + 1];
+    size_t m_free_count[MAX_ORDER + 1];
+
+    // Protects everything above. Every CPU comes here to refill and
+    // drain its cache, and to feed the zeroed pool when idle, so it's
+    // a queued lock. The per-CPU caches are only ever touched by their
+    // own CPU.
+    McsLock m_lock;
+
+    static constexpr size_t FRAME_CACHE_SIZE = 128;
+
+    // A ring of free frame addresses. The top end holds the most
+    // recently freed (and so likely cache-hot) frames, and is where
+    // allocations come from. Only its own CPU touches it, with
+    // interrupts disabled.
+    struct alignas(64) FrameCache {
+        uintptr_t frames[FRAME_CACHE_SIZE];
+        size_t bottom;
+        size_t count;
+
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t refills;
+        uint64_t drains;
+    };
+
+    static PER_CPU FrameCache m_cache;
+    CacheTuning m_tuning;
+
+    // Zeroed pages are linked through Page::priv by PFN, since their
+    // contents have to stay untouched. That means the pool only
+    // exists once the page database does.
+    TicketLock m_zero_lock;
+    size_t m_zero_head;
+    size_t m_zero_count;
+    size_t m_zero_target;
+    uint64_t m_zero_hits;
+    uint64_t m_zero_misses;
+
+    uintptr_t alloc_early(unsigned order);
+    uintptr_t take_zeroed();
+    void put_zeroed(size_t pfn);
+
+    uintptr_t cache_alloc();
+    void cache_free(uintptr_t addr, bool cold);
+    void refill(FrameCache& cache);
+    void drain(FrameCache& cache);
+
+    bool check_free(uintptr_t addr, unsigned order);
+    uintptr_t alloc_block(unsigned order);
+    void free_block(size_t pfn, unsigned order);
+
+    void insert_range(size_t index, uintptr_t start, size_t size);
+    void remove_range(size_t index);
+    void free_range(uintptr_t start, uintptr_t end);
 
-    void add_chunk(List<PageChunk>& chunks, uintptr_t start, size_t size);
+    bool test(unsigned order, size_t pfn) const;
+    void push(unsigned order, size_t pfn);
+    void unlink(unsigned order, size_t pfn);
 };
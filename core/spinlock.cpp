@@ -0,0 +1,32 @@
+#include "spinlock.hpp"
+#include "logging.hpp"
+
+bool LockStats::enabled = false;
+
+// Every tracked lock, newest first
+static LockStats* tracked;
+
+void track_lock(LockStats& stats, const char* name) {
+    if (stats.name) {
+        stats.name = name;
+        return;
+    }
+    stats.name = name;
+    stats.next = __atomic_load_n(&tracked, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&tracked, &stats.next, &stats, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+}
+
+void enable_lock_stats() {
+    __atomic_store_n(&LockStats::enabled, true, __ATOMIC_RELAXED);
+}
+
+void dump_lock_stats() {
+    klog("==Locks==\n");
+    for (auto stats = __atomic_load_n(&tracked, __ATOMIC_ACQUIRE); stats; stats = stats->next) {
+        // Read without the lock, so these may be a little inconsistent
+        klog(stats->name, ": ", udec(stats->acquisitions), " acquisitions, ",
+             udec(stats->contended), " contended, ", udec(stats->spins), " spins, ",
+             udec(stats->max_hold), " ticks max hold\n");
+    }
+}
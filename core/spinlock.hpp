@@ -0,0 +1,269 @@
+#pragma once
+
+#include "cpu.hpp"
+
+// Locks for kernel code. All of them are unlocked when zeroed, so
+// they can live in statically-allocated objects without a constructor.
+//
+//  - SpinLock is a test-and-test-and-set lock: the cheapest when it's
+//    uncontended, but unfair, and every waiter hammers the one line.
+//  - TicketLock hands the lock out in arrival order.
+//  - McsLock queues waiters so each one spins on its own node. Use it
+//    for locks every CPU fights over.
+//
+// None of them disable interrupts. Wrap any lock an interrupt handler
+// can also take in an IrqSaveGuard rather than a LockGuard.
+
+// Contention counters for one lock. A lock only keeps them once it has
+// been given a name with track(), and only while lock stats are on
+// (see enable_lock_stats), so otherwise all it costs is a branch. The
+// counters are only written by whoever holds the lock.
+struct LockStats {
+    const char* name;
+    LockStats* next;
+    uint64_t acquisitions;
+    // Acquisitions that had to wait, and how many times they paused
+    uint64_t contended;
+    uint64_t spins;
+    // Longest the lock has been held, in TSC ticks
+    uint64_t max_hold;
+    uint64_t acquired_at;
+
+    static bool enabled;
+
+    bool recording() const {
+        return __builtin_expect(name != nullptr, 0) && enabled;
+    }
+
+    void acquired(uint64_t waited) {
+        if (!recording()) {
+            return;
+        }
+        acquisitions++;
+        if (waited) {
+            contended++;
+            spins += waited;
+        }
+        acquired_at = rdtsc();
+    }
+
+    void released() {
+        // acquired_at is 0 if stats were switched on while held
+        if (!recording() || !acquired_at) {
+            return;
+        }
+        auto held = rdtsc() - acquired_at;
+        if (held > max_hold) {
+            max_hold = held;
+        }
+        acquired_at = 0;
+    }
+};
+
+// Adds `stats` to the locks dump_lock_stats reports on
+void track_lock(LockStats& stats, const char* name);
+
+// Starts counting on every tracked lock. Tracking is cheap, so owners
+// name their locks unconditionally, and `lockstats` on the command
+// line decides whether anything is counted.
+void enable_lock_stats();
+
+// Logs the counters for every tracked lock
+void dump_lock_stats();
+
+class SpinLock {
+public:
+    void lock() {
+        uint64_t waited = 0;
+        while (__atomic_exchange_n(&m_locked, 1, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&m_locked, __ATOMIC_RELAXED)) {
+                cpu_relax();
+                waited++;
+            }
+        }
+        m_stats.acquired(waited);
+    }
+
+    bool try_lock() {
+        if (__atomic_load_n(&m_locked, __ATOMIC_RELAXED) ||
+            __atomic_exchange_n(&m_locked, 1, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        m_stats.acquired(0);
+        return true;
+    }
+
+    void unlock() {
+        m_stats.released();
+        __atomic_store_n(&m_locked, 0, __ATOMIC_RELEASE);
+    }
+
+    void track(const char* name) { track_lock(m_stats, name); }
+    const LockStats& stats() const { return m_stats; }
+
+private:
+    uint32_t m_locked;
+    LockStats m_stats;
+};
+
+class TicketLock {
+public:
+    void lock() {
+        auto ticket = __atomic_fetch_add(&m_next, 1, __ATOMIC_RELAXED);
+        uint64_t waited = 0;
+        while (true) {
+            auto owner = __atomic_load_n(&m_owner, __ATOMIC_ACQUIRE);
+            if (owner == ticket) {
+                break;
+            }
+            // Back off in proportion to our place in the queue, so the
+            // line isn't read again until it's likely our turn
+            for (uint32_t i = ticket - owner; i; --i) {
+                cpu_relax();
+                waited++;
+            }
+        }
+        m_stats.acquired(waited);
+    }
+
+    bool try_lock() {
+        auto owner = __atomic_load_n(&m_owner, __ATOMIC_RELAXED);
+        auto expected = owner;
+        if (!__atomic_compare_exchange_n(&m_next, &expected, owner + 1, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return false;
+        }
+        m_stats.acquired(0);
+        return true;
+    }
+
+    void unlock() {
+        m_stats.released();
+        // Only the holder writes m_owner, so this needs no RMW
+        __atomic_store_n(&m_owner, m_owner + 1, __ATOMIC_RELEASE);
+    }
+
+    void track(const char* name) { track_lock(m_stats, name); }
+    const LockStats& stats() const { return m_stats; }
+
+private:
+    uint32_t m_next;
+    uint32_t m_owner;
+    LockStats m_stats;
+};
+
+class McsLock {
+public:
+    // Each acquirer brings its own node, which has to stay put until
+    // it unlocks. LockGuard<McsLock> keeps one on the stack.
+    struct Node {
+        Node* next;
+        uint32_t waiting;
+    };
+
+    void lock(Node& node) {
+        node.next = nullptr;
+        node.waiting = 1;
+        auto prev = __atomic_exchange_n(&m_tail, &node, __ATOMIC_ACQ_REL);
+        uint64_t waited = 0;
+        if (prev) {
+            __atomic_store_n(&prev->next, &node, __ATOMIC_RELEASE);
+            while (__atomic_load_n(&node.waiting, __ATOMIC_ACQUIRE)) {
+                cpu_relax();
+                waited++;
+            }
+        }
+        m_stats.acquired(waited);
+    }
+
+    bool try_lock(Node& node) {
+        node.next = nullptr;
+        node.waiting = 0;
+        Node* expected = nullptr;
+        if (!__atomic_compare_exchange_n(&m_tail, &expected, &node, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return false;
+        }
+        m_stats.acquired(0);
+        return true;
+    }
+
+    void unlock(Node& node) {
+        m_stats.released();
+        auto next = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE);
+        if (!next) {
+            auto expected = &node;
+            if (__atomic_compare_exchange_n(&m_tail, &expected, nullptr, false,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            // Someone has queued behind us but not linked in yet
+            while (!(next = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE))) {
+                cpu_relax();
+            }
+        }
+        __atomic_store_n(&next->waiting, 0, __ATOMIC_RELEASE);
+    }
+
+    void track(const char* name) { track_lock(m_stats, name); }
+    const LockStats& stats() const { return m_stats; }
+
+private:
+    Node* m_tail;
+    LockStats m_stats;
+};
+
+template <typename L>
+class LockGuard {
+public:
+    explicit LockGuard(L& lock) : m_lock(lock) { m_lock.lock(); }
+    ~LockGuard() { m_lock.unlock(); }
+
+    LockGuard(const LockGuard&) = delete;
+    LockGuard& operator=(const LockGuard&) = delete;
+
+private:
+    L& m_lock;
+};
+
+template <>
+class LockGuard<McsLock> {
+public:
+    explicit LockGuard(McsLock& lock) : m_lock(lock) { m_lock.lock(m_node); }
+    ~LockGuard() { m_lock.unlock(m_node); }
+
+    LockGuard(const LockGuard&) = delete;
+    LockGuard& operator=(const LockGuard&) = delete;
+
+private:
+    McsLock& m_lock;
+    McsLock::Node m_node;
+};
+
+// Disables interrupts for its lifetime, then puts them back how they
+// were
+class InterruptGuard {
+public:
+    InterruptGuard() : m_enabled(save_interrupts()) {}
+    ~InterruptGuard() { restore_interrupts(m_enabled); }
+
+    InterruptGuard(const InterruptGuard&) = delete;
+    InterruptGuard& operator=(const InterruptGuard&) = delete;
+
+private:
+    bool m_enabled;
+};
+
+// Holds a lock with interrupts disabled, so an interrupt handler on
+// the same CPU can't spin forever on a lock its own CPU holds.
+// Interrupts go off before the lock is taken and come back after it's
+// released.
+template <typename L>
+class IrqSaveGuard {
+public:
+    explicit IrqSaveGuard(L& lock) : m_guard(lock) {}
+
+private:
+    InterruptGuard m_interrupts;
+    LockGuard<L> m_guard;
+};
@@ -1,4 +1,5 @@
 #include "string.hpp"
+#include "cpu.hpp"
 
 extern "C" char* strcpy(char* dest, const char* src) {
     auto ret = dest;
@@ -19,8 +20,56 @@ extern "C" size_t strlen(const char* str) {
     return len;
 }
 
+// The compiler is free to call these for struct copies and the like,
+// so they have to exist even if nothing calls them by name.
+extern "C" void* memcpy(void* dest, const void* src, size_t n) {
+    copy_forward(dest, src, n);
+    return dest;
+}
+
+extern "C" void* memmove(void* dest, const void* src, size_t n) {
+    if ((uintptr_t)dest <= (uintptr_t)src || (uintptr_t)dest >= (uintptr_t)src + n) {
+        copy_forward(dest, src, n);
+    } else {
+        copy_backward(dest, src, n);
+    }
+    return dest;
+}
+
+extern "C" void* memset(void* dest, int c, size_t n) {
+    fill_bytes(dest, c, n);
+    return dest;
+}
+
 String::String(const char* src) {
     _cap = _len = strlen(src);
     _data = new char[_len+1];
     strcpy(_data, src);
 }
+
+const char* cmdline_option(const char* cmdline, const char* name) {
+    auto word = cmdline;
+    while (*word) {
+        while (*word == ' ') {
+            word++;
+        }
+        auto c = word;
+        auto n = name;
+        while (*n && *c == *n) {
+            c++;
+            n++;
+        }
+        if (!*n) {
+            if (*c == '=') {
+                return c + 1;
+            }
+            if (*c == ' ' || *c == 0) {
+                return c;
+            }
+        }
+        while (*word && *word != ' ') {
+            word++;
+        }
+    }
+    return nullptr;
+}
@@ -2,6 +2,12 @@
 
 #include <stddef.h>
 
+extern "C" char* strcpy(char* dest, const char* src);
+extern "C" size_t strlen(const char* str);
+extern "C" void* memcpy(void* dest, const void* src, size_t n);
+extern "C" void* memmove(void* dest, const void* src, size_t n);
+extern "C" void* memset(void* dest, int c, size_t n);
+
 class String {
 public:
     String() = default;
@@ -15,3 +21,9 @@ private:
     size_t _len;
     size_t _cap;
 };
+
+// Looks up `name` among the space-separated words of a kernel command
+// line. For `name=value` this returns the value (which runs up to the
+// next space), for a bare `name` an empty string, and nullptr if it
+// isn't there at all.
+const char* cmdline_option(const char* cmdline, const char* name);
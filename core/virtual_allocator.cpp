@@ -0,0 +1,322 @@
+#include "virtual_allocator.hpp"
+#include "logging.hpp"
+
+struct RangeNode {
+    uintptr_t start;
+    size_t size;
+    // Unmapped bytes below start, for allocated ranges
+    size_t guard;
+    // Largest size in this subtree
+    size_t max;
+    RangeNode* left;
+    RangeNode* right;
+    int height;
+};
+
+static int height(const RangeNode* node) {
+    return node ? node->height : 0;
+}
+
+static size_t max_size(const RangeNode* node) {
+    return node ? node->max : 0;
+}
+
+static void update(RangeNode* node) {
+    auto left = height(node->left);
+    auto right = height(node->right);
+    node->height = 1 + (left > right ? left : right);
+
+    node->max = node->size;
+    if (max_size(node->left) > node->max) {
+        node->max = max_size(node->left);
+    }
+    if (max_size(node->right) > node->max) {
+        node->max = max_size(node->right);
+    }
+}
+
+static RangeNode* rotate_right(RangeNode* node) {
+    auto left = node->left;
+    node->left = left->right;
+    left->right = node;
+    update(node);
+    update(left);
+    return left;
+}
+
+static RangeNode* rotate_left(RangeNode* node) {
+    auto right = node->right;
+    node->right = right->left;
+    right->left = node;
+    update(node);
+    update(right);
+    return right;
+}
+
+static RangeNode* balance(RangeNode* node) {
+    update(node);
+    auto skew = height(node->left) - height(node->right);
+    if (skew > 1) {
+        if (height(node->left->left) < height(node->left->right)) {
+            node->left = rotate_left(node->left);
+        }
+        return rotate_right(node);
+    }
+    if (skew < -1) {
+        if (height(node->right->right) < height(node->right->left)) {
+            node->right = rotate_right(node->right);
+        }
+        return rotate_left(node);
+    }
+    return node;
+}
+
+static RangeNode* insert(RangeNode* root, RangeNode* node) {
+    if (!root) {
+        node->left = nullptr;
+        node->right = nullptr;
+        update(node);
+        return node;
+    }
+    if (node->start < root->start) {
+        root->left = insert(root->left, node);
+    } else {
+        root->right = insert(root->right, node);
+    }
+    return balance(root);
+}
+
+// Unlinks the lowest node of the subtree into `min`
+static RangeNode* remove_min(RangeNode* root, RangeNode*& min) {
+    if (!root->left) {
+        min = root;
+        return root->right;
+    }
+    root->left = remove_min(root->left, min);
+    return balance(root);
+}
+
+// Unlinks `node`, which must be in the tree
+static RangeNode* remove(RangeNode* root, RangeNode* node) {
+    if (node->start < root->start) {
+        root->left = remove(root->left, node);
+    } else if (node->start > root->start) {
+        root->right = remove(root->right, node);
+    } else {
+        auto left = root->left;
+        auto right = root->right;
+        if (!right) {
+            return left;
+        }
+        RangeNode* min;
+        right = remove_min(right, min);
+        min->left = left;
+        min->right = right;
+        return balance(min);
+    }
+    return balance(root);
+}
+
+static RangeNode* find(RangeNode* root, uintptr_t start) {
+    while (root && root->start != start) {
+        root = start < root->start ? root->left : root->right;
+    }
+    return root;
+}
+
+// The node with the highest start below `addr`
+static RangeNode* below(RangeNode* root, uintptr_t addr) {
+    RangeNode* best = nullptr;
+    while (root) {
+        if (root->start < addr) {
+            best = root;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return best;
+}
+
+// The node with the lowest start above `addr`
+static RangeNode* above(RangeNode* root, uintptr_t addr) {
+    RangeNode* best = nullptr;
+    while (root) {
+        if (root->start > addr) {
+            best = root;
+            root = root->left;
+        } else {
+            root = root->right;
+        }
+    }
+    return best;
+}
+
+// The lowest node of at least `size` bytes. The max field tells us
+// which side of each node to look in.
+static RangeNode* first_fit(RangeNode* root, size_t size) {
+    while (root && root->max >= size) {
+        if (max_size(root->left) >= size) {
+            root = root->left;
+        } else if (root->size >= size) {
+            return root;
+        } else {
+            root = root->right;
+        }
+    }
+    return nullptr;
+}
+
+VirtualAllocator& VirtualAllocator::global() {
+    static VirtualAllocator instance;
+    return instance;
+}
+
+void VirtualAllocator::init(uintptr_t start, size_t size) {
+    auto node = new RangeNode{start, size, 0, 0, nullptr, nullptr, 0};
+    LockGuard<SpinLock> guard(m_lock);
+    m_free = insert(m_free, node);
+}
+
+uintptr_t VirtualAllocator::alloc(size_t size, size_t align, size_t guard) {
+    size = (size + PAGE_MASK) & ~PAGE_MASK;
+    guard = (guard + PAGE_MASK) & ~PAGE_MASK;
+    if (align < PAGE_SIZE) {
+        align = PAGE_SIZE;
+    }
+    if (size == 0 || (align & (align - 1))) {
+        return 0;
+    }
+
+    auto busy = new RangeNode;
+    if (!busy) {
+        return 0;
+    }
+
+    LockGuard<SpinLock> lock(m_lock);
+    // Any free range this big has an aligned fit in it somewhere, so
+    // we never have to look past the first one.
+    auto node = first_fit(m_free, guard + size + align - PAGE_SIZE);
+    if (!node) {
+        delete busy;
+        klog("Out of virtual address space for ", size, " bytes\n");
+        return 0;
+    }
+    m_free = remove(m_free, node);
+
+    auto addr = (node->start + guard + align - 1) & ~(align - 1);
+    auto end = node->start + node->size;
+
+    // Whatever is left on either side goes back in the tree, reusing
+    // the node we took out if possible.
+    if (addr - guard > node->start) {
+        node->size = addr - guard - node->start;
+        m_free = insert(m_free, node);
+        node = nullptr;
+    }
+    if (addr + size < end) {
+        if (!node) {
+            node = new RangeNode;
+        }
+        if (node) {
+            *node = {addr + size, end - (addr + size), 0, 0, nullptr, nullptr, 0};
+            m_free = insert(m_free, node);
+        } else {
+            klog("Lost virtual range ", addr + size, ":", end, "\n");
+        }
+    } else if (node) {
+        delete node;
+    }
+
+    *busy = {addr, size, guard, 0, nullptr, nullptr, 0};
+    m_busy = insert(m_busy, busy);
+    return addr;
+}
+
+void VirtualAllocator::free(uintptr_t addr) {
+    RangeNode* node;
+    {
+        LockGuard<SpinLock> lock(m_lock);
+        node = find(m_busy, addr);
+        if (!node) {
+            klog("Tried to free an unallocated virtual range at ", addr, "\n");
+            return;
+        }
+        m_busy = remove(m_busy, node);
+    }
+
+    // The range is in neither tree while it's unmapped, so nobody can
+    // be handed it before the shootdown is done, and nobody waits on
+    // the shootdown for the lock.
+    PageTable::current().unmap(addr, node->size);
+
+    // The guard goes back along with the range, and then we merge with
+    // any free neighbours.
+    LockGuard<SpinLock> lock(m_lock);
+    node->start -= node->guard;
+    node->size += node->guard;
+    node->guard = 0;
+    auto prev = below(m_free, node->start);
+    if (prev && prev->start + prev->size == node->start) {
+        m_free = remove(m_free, prev);
+        node->start = prev->start;
+        node->size += prev->size;
+        delete prev;
+    }
+    auto next = above(m_free, node->start);
+    if (next && node->start + node->size == next->start) {
+        m_free = remove(m_free, next);
+        node->size += next->size;
+        delete next;
+    }
+    m_free = insert(m_free, node);
+}
+
+uintptr_t VirtualAllocator::map_frames(const uintptr_t* frames, size_t count,
+                                       MemoryType type, size_t guard) {
+    // Ranges big enough for a big page are aligned for one, in case
+    // some of the frames line up.
+    auto size = count * PAGE_SIZE;
+    auto addr = alloc(size, size >= BIG_PAGE_SIZE ? BIG_PAGE_SIZE : PAGE_SIZE, guard);
+    if (!addr) {
+        return 0;
+    }
+    if (!PageTable::current().map_frames(frames, count, addr, type)) {
+        free(addr);
+        return 0;
+    }
+    return addr;
+}
+
+uintptr_t VirtualAllocator::map_physical(uintptr_t phys, size_t size, MemoryType type) {
+    auto start = phys & ~PAGE_MASK;
+    auto end = (phys + size + PAGE_MASK) & ~PAGE_MASK;
+    auto align = PAGE_SIZE;
+    if (end - start >= BIG_PAGE_SIZE && !(start & BIG_PAGE_MASK)) {
+        align = BIG_PAGE_SIZE;
+    }
+    auto addr = alloc(end - start, align);
+    if (!addr) {
+        return 0;
+    }
+    if (!PageTable::current().map(start, addr, end - start, type)) {
+        free(addr);
+        return 0;
+    }
+    return addr + (phys - start);
+}
+
+static void dump_tree(const RangeNode* node, const char* kind) {
+    if (!node) {
+        return;
+    }
+    dump_tree(node->left, kind);
+    klog(kind, node->start, ":", node->start + node->size, "\n");
+    dump_tree(node->right, kind);
+}
+
+void VirtualAllocator::dump() const {
+    klog("==Virtual Allocator==\n");
+    dump_tree(m_free, "free ");
+    dump_tree(m_busy, "used ");
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "kmemlayout.h"
+#include "paging.hpp"
+#include "spinlock.hpp"
+
+struct RangeNode;
+
+// Hands out ranges of kernel virtual address space. Free ranges are
+// kept in an AVL tree ordered by address, where each node also knows
+// the largest free range below it, so finding the lowest range that
+// fits takes O(log n). Allocated ranges are kept in a second tree so
+// they can be freed by address.
+//
+// Only address space is managed here. Mapping it is up to the caller,
+// or to map_frames/map_physical.
+class VirtualAllocator {
+public:
+    static VirtualAllocator& global();
+
+    void init(uintptr_t start, size_t size);
+
+    // Reserves `size` bytes aligned to `align`, which must be a power
+    // of two (BIG_PAGE_SIZE or HUGE_PAGE_SIZE let the range use large
+    // pages). `guard` bytes below the range are kept unmapped, so
+    // running off the bottom of it (say, a stack) faults instead of
+    // hitting a neighbour. Returns 0 if there's no room.
+    uintptr_t alloc(size_t size, size_t align = PAGE_SIZE, size_t guard = 0);
+
+    // Returns a range from alloc(), unmapping anything still mapped in
+    // it. Frames mapped there aren't freed.
+    void free(uintptr_t addr);
+
+    // Maps `count` frames, which needn't be contiguous, into a fresh
+    // range. Returns 0 if there's no room, or no memory for page
+    // tables.
+    uintptr_t map_frames(const uintptr_t* frames, size_t count,
+                         MemoryType type = MemoryType::WriteBack, size_t guard = 0);
+
+    // Maps [phys, phys + size) into a fresh range, and returns the
+    // address of `phys` in it. Meant for device memory.
+    uintptr_t map_physical(uintptr_t phys, size_t size, MemoryType type);
+
+    void dump() const;
+
+private:
+    RangeNode* m_free;
+    RangeNode* m_busy;
+    SpinLock m_lock;
+};
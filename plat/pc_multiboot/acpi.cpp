@@ -0,0 +1,182 @@
+#include "acpi.hpp"
+#include "logging.hpp"
+#include "paging.hpp"
+#include "virtual_allocator.hpp"
+
+#define MADT_LOCAL_APIC 0
+#define MADT_IOAPIC 1
+#define MADT_OVERRIDE 2
+#define MADT_LOCAL_APIC_ADDRESS 5
+
+// Processor flags: usable now, or can be brought online later
+#define LOCAL_APIC_ENABLED 0x1
+#define LOCAL_APIC_ONLINE_CAPABLE 0x2
+
+namespace {
+    struct Rsdp {
+        char signature[8];
+        uint8_t checksum;
+        char oem_id[6];
+        uint8_t revision;
+        uint32_t rsdt;
+        // ACPI 2.0 and up
+        uint32_t length;
+        uint64_t xsdt;
+        uint8_t extended_checksum;
+        uint8_t reserved[3];
+    } __attribute__((packed));
+
+    struct SdtHeader {
+        char signature[4];
+        uint32_t length;
+        uint8_t revision;
+        uint8_t checksum;
+        char oem_id[6];
+        char oem_table_id[8];
+        uint32_t oem_revision;
+        uint32_t creator_id;
+        uint32_t creator_revision;
+    } __attribute__((packed));
+
+    struct MadtHeader {
+        SdtHeader header;
+        uint32_t local_apic;
+        uint32_t flags;
+    } __attribute__((packed));
+}
+
+static Acpi::Madt the_madt;
+
+const Acpi::Madt& Acpi::madt() {
+    return the_madt;
+}
+
+static bool checksum_ok(const void* data, size_t length) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        sum += ((const uint8_t*)data)[i];
+    }
+    return sum == 0;
+}
+
+static void unmap_table(const SdtHeader* table) {
+    VirtualAllocator::global().free((uintptr_t)table & ~PAGE_MASK);
+}
+
+// Maps the whole table at `phys`. ACPI tables tend to live in memory
+// the firmware reserved, which isn't in the direct map. Returns
+// nullptr if it can't be mapped or fails its checksum.
+static const SdtHeader* map_table(uintptr_t phys) {
+    auto& va = VirtualAllocator::global();
+    auto header = (const SdtHeader*)va.map_physical(phys, sizeof(SdtHeader), MemoryType::WriteBack);
+    if (!header) {
+        return nullptr;
+    }
+    auto length = header->length;
+    unmap_table(header);
+
+    auto table = (const SdtHeader*)va.map_physical(phys, length, MemoryType::WriteBack);
+    if (table && !checksum_ok(table, length)) {
+        unmap_table(table);
+        return nullptr;
+    }
+    return table;
+}
+
+static bool is(const SdtHeader* table, const char* signature) {
+    for (int i = 0; i < 4; ++i) {
+        if (table->signature[i] != signature[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void read_madt(const MadtHeader* madt) {
+    auto& out = the_madt;
+    out.local_apic = madt->local_apic;
+
+    auto entry = (const uint8_t*)(madt + 1);
+    auto end = (const uint8_t*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+        case MADT_LOCAL_APIC: {
+            auto flags = *(const uint32_t*)(entry + 4);
+            // Starting an online-capable CPU that isn't there would just
+            // wait out the whole startup timeout
+            if ((flags & LOCAL_APIC_ENABLED) && out.num_cpus < MAX_CPUS) {
+                out.apic_ids[out.num_cpus++] = entry[3];
+            } else if (flags & LOCAL_APIC_ONLINE_CAPABLE) {
+                out.num_online_capable++;
+            }
+            break;
+        }
+        case MADT_IOAPIC:
+            if (out.num_ioapics < ACPI_MAX_IOAPICS) {
+                out.ioapics[out.num_ioapics++] = {
+                    entry[2],
+                    *(const uint32_t*)(entry + 4),
+                    *(const uint32_t*)(entry + 8),
+                };
+            }
+            break;
+        case MADT_OVERRIDE:
+            if (out.num_overrides < ACPI_MAX_OVERRIDES) {
+                out.overrides[out.num_overrides++] = {
+                    entry[3],
+                    *(const uint32_t*)(entry + 4),
+                    *(const uint16_t*)(entry + 8),
+                };
+            }
+            break;
+        case MADT_LOCAL_APIC_ADDRESS:
+            out.local_apic = *(const uint64_t*)(entry + 4);
+            break;
+        }
+        entry += entry[1];
+    }
+}
+
+bool Acpi::init(const BootInfo::Acpi& acpi) {
+    auto rsdp = (const Rsdp*)acpi.rsdp;
+    if (!checksum_ok(rsdp, 20)) {
+        klog("Bad ACPI RSDP checksum\n");
+        return false;
+    }
+
+    // The XSDT has 64-bit pointers where the RSDT has 32-bit ones
+    bool extended = rsdp->revision >= 2 && acpi.rsdp_size >= sizeof(Rsdp) && rsdp->xsdt;
+    auto root = map_table(extended ? rsdp->xsdt : rsdp->rsdt);
+    if (!root) {
+        klog("Couldn't read the ACPI root table\n");
+        return false;
+    }
+
+    size_t pointer_size = extended ? 8 : 4;
+    auto count = (root->length - sizeof(SdtHeader)) / pointer_size;
+    auto pointers = (const uint8_t*)(root + 1);
+    bool found = false;
+    for (size_t i = 0; i < count && !found; ++i) {
+        uintptr_t phys = extended ? *(const uint64_t*)(pointers + i * 8) :
+            *(const uint32_t*)(pointers + i * 4);
+        auto table = map_table(phys);
+        if (!table) {
+            continue;
+        }
+        if (is(table, "APIC")) {
+            read_madt((const MadtHeader*)table);
+            found = true;
+        }
+        unmap_table(table);
+    }
+    unmap_table(root);
+
+    if (!found) {
+        klog("No MADT\n");
+        return false;
+    }
+    klog("MADT: ", udec(the_madt.num_cpus), " CPUs (", udec(the_madt.num_online_capable),
+         " more online-capable), ", udec(the_madt.num_ioapics),
+         " I/O APICs, local APIC at ", the_madt.local_apic, "\n");
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "cpu.hpp"
+#include "boot_information.hpp"
+
+// Limits on what we keep from the MADT. Anything past these is dropped.
+#define ACPI_MAX_IOAPICS 8
+#define ACPI_MAX_OVERRIDES 16
+
+// Just enough ACPI to find the processors and interrupt controllers:
+// the RSDT/XSDT and the MADT.
+namespace Acpi {
+    struct Madt {
+        uintptr_t local_apic;
+
+        // Every usable processor, the boot CPU included
+        size_t num_cpus;
+        uint32_t apic_ids[MAX_CPUS];
+        // Processors that could be hot-added later, but aren't there
+        // now. They're counted, not started.
+        size_t num_online_capable;
+
+        struct IoApic {
+            uint8_t id;
+            uintptr_t addr;
+            uint32_t gsi_base;
+        };
+        size_t num_ioapics;
+        IoApic ioapics[ACPI_MAX_IOAPICS];
+
+        // ISA IRQs that aren't wired to the GSI of the same number
+        struct Override {
+            uint8_t irq;
+            uint32_t gsi;
+            uint16_t flags;
+        };
+        size_t num_overrides;
+        Override overrides[ACPI_MAX_OVERRIDES];
+    };
+
+    // Finds and reads the MADT through the RSDP the bootloader gave
+    // us. Returns false if there isn't a valid one.
+    bool init(const BootInfo::Acpi& acpi);
+
+    const Madt& madt();
+}
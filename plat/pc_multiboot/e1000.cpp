@@ -0,0 +1,148 @@
+#include "e1000.hpp"
+#include "pci.hpp"
+#include "cpu.hpp"
+#include "logging.hpp"
+#include "paging.hpp"
+#include "page_allocator.hpp"
+#include "virtual_allocator.hpp"
+
+#define E1000_VENDOR 0x8086
+#define E1000_DEVICE 0x100e
+
+// Size of the register window in BAR0
+#define E1000_MMIO_SIZE 0x20000
+
+#define REG_CTRL 0x0000
+#define REG_IMC 0x00d8
+#define REG_TCTL 0x0400
+#define REG_TIPG 0x0410
+#define REG_TDBAL 0x3800
+#define REG_TDBAH 0x3804
+#define REG_TDLEN 0x3808
+#define REG_TDH 0x3810
+#define REG_TDT 0x3818
+#define REG_RAL0 0x5400
+#define REG_RAH0 0x5404
+
+#define CTRL_ASDE (1 << 5)
+#define CTRL_SLU (1 << 6)
+#define CTRL_RST (1 << 26)
+
+// Enable, pad short packets, and the collision settings the manual
+// recommends for full duplex
+#define TCTL_EN (1 << 1)
+#define TCTL_PSP (1 << 3)
+#define TCTL_CT (0x0f << 4)
+#define TCTL_COLD (0x40 << 12)
+
+// Inter-packet gap, again straight from the manual
+#define TIPG_DEFAULT 0x0060200a
+
+#define TX_CMD_EOP 0x01
+#define TX_CMD_IFCS 0x02
+#define TX_CMD_RS 0x08
+#define TX_STATUS_DD 0x01
+
+E1000* E1000::probe() {
+    Pci::Address addr;
+    if (!Pci::find(E1000_VENDOR, E1000_DEVICE, addr)) {
+        return nullptr;
+    }
+
+    auto bar = Pci::memory_bar(addr, 0);
+    if (!bar) {
+        klog("e1000: no memory BAR\n");
+        return nullptr;
+    }
+    Pci::enable_bus_master(addr);
+
+    auto regs = VirtualAllocator::global().map_physical(bar, E1000_MMIO_SIZE, MemoryType::Uncached);
+    if (!regs) {
+        klog("e1000: couldn't map registers at ", bar, "\n");
+        return nullptr;
+    }
+
+    auto nic = new E1000((volatile uint32_t*)regs);
+    if (!nic->init()) {
+        delete nic;
+        VirtualAllocator::global().free(regs);
+        return nullptr;
+    }
+    return nic;
+}
+
+bool E1000::init() {
+    // The descriptor ring fits in one page. Buffers are physically
+    // contiguous so each one's address is just an offset.
+    auto ring = PageAllocator::global().alloc_zeroed();
+    auto buffers = PageAllocator::global().alloc(E1000_TX_SLOTS * E1000_TX_BUFFER);
+    if (!ring || !buffers) {
+        klog("e1000: out of memory for the transmit ring\n");
+        if (ring) {
+            PageAllocator::global().free(ring, 0);
+        }
+        if (buffers) {
+            PageAllocator::global().free(buffers,
+                PageAllocator::order_for(E1000_TX_SLOTS * E1000_TX_BUFFER));
+        }
+        return false;
+    }
+    m_tx_ring = phys_to_virt<TxDescriptor>(ring);
+    m_tx_buffers = phys_to_virt<uint8_t>(buffers);
+    m_tx_buffers_phys = buffers;
+    m_tx_tail = 0;
+
+    write(REG_IMC, 0xffffffff);
+    write(REG_CTRL, read(REG_CTRL) | CTRL_RST);
+    while (read(REG_CTRL) & CTRL_RST) {
+        cpu_relax();
+    }
+    write(REG_IMC, 0xffffffff);
+    write(REG_CTRL, read(REG_CTRL) | CTRL_SLU | CTRL_ASDE);
+
+    // Reset loads the MAC address from the EEPROM into the first
+    // receive address register
+    auto low = read(REG_RAL0);
+    auto high = read(REG_RAH0);
+    for (int i = 0; i < 4; ++i) {
+        m_mac[i] = low >> (i * 8);
+    }
+    m_mac[4] = high;
+    m_mac[5] = high >> 8;
+
+    // Every descriptor starts out done, so tx_buffer() doesn't wait on
+    // any of them the first time round
+    for (size_t i = 0; i < E1000_TX_SLOTS; ++i) {
+        m_tx_ring[i].addr = m_tx_buffers_phys + i * E1000_TX_BUFFER;
+        m_tx_ring[i].status = TX_STATUS_DD;
+    }
+    write(REG_TDBAL, ring);
+    write(REG_TDBAH, ring >> 32);
+    write(REG_TDLEN, E1000_TX_SLOTS * sizeof(TxDescriptor));
+    write(REG_TDH, 0);
+    write(REG_TDT, 0);
+    write(REG_TIPG, TIPG_DEFAULT);
+    write(REG_TCTL, TCTL_EN | TCTL_PSP | TCTL_CT | TCTL_COLD);
+    return true;
+}
+
+uint8_t* E1000::tx_buffer() {
+    auto& desc = m_tx_ring[m_tx_tail];
+    while (!(desc.status & TX_STATUS_DD)) {
+        cpu_relax();
+    }
+    return m_tx_buffers + m_tx_tail * E1000_TX_BUFFER;
+}
+
+void E1000::transmit(size_t length) {
+    auto& desc = m_tx_ring[m_tx_tail];
+    desc.length = length;
+    desc.cmd = TX_CMD_EOP | TX_CMD_IFCS | TX_CMD_RS;
+    desc.status = 0;
+    m_tx_tail = (m_tx_tail + 1) % E1000_TX_SLOTS;
+    // The descriptor has to be in memory before the card sees the new
+    // tail. MMIO is uncached, so the store can't pass it on x86, but
+    // the compiler could.
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    write(REG_TDT, m_tx_tail);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+// Transmit descriptors, and so packets in flight
+#define E1000_TX_SLOTS 32
+
+// Each transmit descriptor has a buffer this big, enough for a whole
+// Ethernet frame
+#define E1000_TX_BUFFER 2048
+
+// An Intel 82540EM, the NIC QEMU emulates with -device e1000. Only the
+// transmit side is set up, and it's polled: nothing here uses
+// interrupts.
+class E1000 {
+public:
+    // Finds and resets the first e1000 on the PCI bus. Returns nullptr
+    // if there isn't one, or it couldn't be set up.
+    static E1000* probe();
+
+    const uint8_t* mac() const { return m_mac; }
+
+    // Returns the buffer the next packet goes in, waiting for the card
+    // to finish with it if it's still being sent.
+    uint8_t* tx_buffer();
+
+    // Queues the first `length` bytes of tx_buffer() to be sent
+    void transmit(size_t length);
+
+private:
+    struct TxDescriptor {
+        uint64_t addr;
+        uint16_t length;
+        uint8_t cso;
+        uint8_t cmd;
+        uint8_t status;
+        uint8_t css;
+        uint16_t special;
+    };
+    static_assert(sizeof(TxDescriptor) == 16, "e1000 descriptors are 16 bytes");
+
+    E1000(volatile uint32_t* regs) : m_regs(regs) {}
+
+    bool init();
+
+    uint32_t read(uint32_t reg) const { return m_regs[reg / 4]; }
+    void write(uint32_t reg, uint32_t value) { m_regs[reg / 4] = value; }
+
+    volatile uint32_t* m_regs;
+    volatile TxDescriptor* m_tx_ring;
+    uint8_t* m_tx_buffers;
+    uintptr_t m_tx_buffers_phys;
+    // Next descriptor to fill
+    uint32_t m_tx_tail;
+    uint8_t m_mac[6];
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "stdint.h"
+
+// A 5x7 bitmap font, drawn in a 6x8 cell so there's a pixel of space
+// to the right of and below each glyph
+#define FONT_GLYPH_WIDTH 5
+#define FONT_GLYPH_HEIGHT 7
+#define FONT_CELL_WIDTH 6
+#define FONT_CELL_HEIGHT 8
+
+// Only printable ASCII has glyphs
+#define FONT_FIRST 0x20
+#define FONT_LAST 0x7e
+
+extern const uint8_t font_glyphs[FONT_LAST - FONT_FIRST + 1][FONT_GLYPH_HEIGHT];
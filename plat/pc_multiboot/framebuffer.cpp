@@ -0,0 +1,128 @@
+#include "framebuffer.hpp"
+#include "font.hpp"
+#include "cpu.hpp"
+#include "string.hpp"
+#include "paging.hpp"
+#include "virtual_allocator.hpp"
+
+#define CELL_WIDTH (FONT_CELL_WIDTH * FRAMEBUFFER_FONT_SCALE)
+#define CELL_HEIGHT (FONT_CELL_HEIGHT * FRAMEBUFFER_FONT_SCALE)
+
+// Light grey, like a VGA text console
+#define FOREGROUND_LEVEL 0xaa
+
+FramebufferSink* FramebufferSink::create(const FramebufferInfo& info) {
+    if (info.bpp != 32 || info.width < CELL_WIDTH || info.height < CELL_HEIGHT) {
+        klog("Can't use a ", udec(info.bpp), " bit framebuffer for the console\n");
+        return nullptr;
+    }
+
+    auto size = (size_t)info.pitch * info.height;
+    auto screen = VirtualAllocator::global().map_physical(info.phys, size, MemoryType::WriteCombining);
+    if (!screen) {
+        klog("Couldn't map the framebuffer at ", info.phys, "\n");
+        return nullptr;
+    }
+
+    auto sink = new FramebufferSink;
+    sink->m_screen = (volatile uint8_t*)screen;
+    sink->m_pitch = info.pitch;
+    sink->m_width = info.width;
+    sink->m_height = info.height;
+    sink->m_foreground = FOREGROUND_LEVEL << info.red_position |
+        FOREGROUND_LEVEL << info.green_position | FOREGROUND_LEVEL << info.blue_position;
+    sink->m_columns = info.width / CELL_WIDTH;
+    sink->m_rows = info.height / CELL_HEIGHT;
+    sink->m_column = 0;
+    sink->m_row = 0;
+
+    sink->m_shadow = new uint32_t[(size_t)info.width * info.height];
+    memset(sink->m_shadow, 0, (size_t)info.width * info.height * sizeof(uint32_t));
+    sink->m_dirty_first = 0;
+    sink->m_dirty_last = info.height;
+    sink->flush();
+    return sink;
+}
+
+void FramebufferSink::writec(char c) {
+    write(&c, 1);
+}
+
+void FramebufferSink::write(const char* str, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        auto c = str[i];
+        if (c == '\n') {
+            newline();
+        } else if (c == '\r') {
+            m_column = 0;
+        } else {
+            if (m_column == m_columns) {
+                newline();
+            }
+            draw(c);
+            m_column++;
+        }
+    }
+}
+
+void FramebufferSink::draw(char c) {
+    if (c < FONT_FIRST || c > FONT_LAST) {
+        c = '?';
+    }
+    auto glyph = font_glyphs[c - FONT_FIRST];
+    auto x = m_column * CELL_WIDTH;
+    auto y = m_row * CELL_HEIGHT;
+
+    // The whole cell is drawn, background included, so whatever was
+    // there before is gone
+    for (uint32_t row = 0; row < CELL_HEIGHT; ++row) {
+        auto font_row = row / FRAMEBUFFER_FONT_SCALE;
+        uint8_t bits = font_row < FONT_GLYPH_HEIGHT ? glyph[font_row] : 0;
+        auto pixels = m_shadow + (size_t)(y + row) * m_width + x;
+        for (uint32_t col = 0; col < CELL_WIDTH; ++col) {
+            auto font_col = col / FRAMEBUFFER_FONT_SCALE;
+            bool on = font_col < FONT_GLYPH_WIDTH && (bits >> (FONT_GLYPH_WIDTH - 1 - font_col)) & 1;
+            pixels[col] = on ? m_foreground : 0;
+        }
+    }
+    dirty(y, y + CELL_HEIGHT);
+}
+
+void FramebufferSink::newline() {
+    m_column = 0;
+    if (m_row + 1 < m_rows) {
+        m_row++;
+        return;
+    }
+
+    // Everything moves up a line, and the bottom line is cleared
+    auto line = (size_t)CELL_HEIGHT * m_width;
+    auto text = (size_t)m_rows * line;
+    memmove(m_shadow, m_shadow + line, (text - line) * sizeof(uint32_t));
+    memset(m_shadow + text - line, 0, line * sizeof(uint32_t));
+    dirty(0, m_rows * CELL_HEIGHT);
+}
+
+void FramebufferSink::dirty(uint32_t first, uint32_t last) {
+    if (m_dirty_first == m_dirty_last) {
+        m_dirty_first = first;
+        m_dirty_last = last;
+        return;
+    }
+    if (first < m_dirty_first) {
+        m_dirty_first = first;
+    }
+    if (last > m_dirty_last) {
+        m_dirty_last = last;
+    }
+}
+
+void FramebufferSink::flush() {
+    // Rows go out whole with string moves, which is about the best
+    // case for write-combining
+    auto row_size = m_width * sizeof(uint32_t);
+    for (auto y = m_dirty_first; y < m_dirty_last; ++y) {
+        copy_forward((void*)(m_screen + (size_t)y * m_pitch), m_shadow + (size_t)y * m_width, row_size);
+    }
+    m_dirty_first = m_dirty_last = 0;
+}
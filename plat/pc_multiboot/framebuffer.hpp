@@ -0,0 +1,60 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "logging.hpp"
+
+// Each font pixel is drawn as a square this many pixels across
+#define FRAMEBUFFER_FONT_SCALE 2
+
+// What we need to know about the bootloader's framebuffer
+struct FramebufferInfo {
+    uintptr_t phys;
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t red_position;
+    uint8_t green_position;
+    uint8_t blue_position;
+};
+
+// A text console on a linear framebuffer, for `log=fb`. Text is drawn
+// into a shadow copy of the screen in ordinary memory, and flush()
+// copies out only the rows that changed since the last one, to a
+// write-combining mapping of the framebuffer. Scrolling moves the
+// whole shadow buffer up a line in one go and redraws nothing.
+class FramebufferSink : public Sink {
+public:
+    // Returns nullptr unless the framebuffer is 32 bit RGB and it
+    // could be mapped
+    static FramebufferSink* create(const FramebufferInfo& info);
+
+    void writec(char c) override;
+    void write(const char* str, size_t length) override;
+    void flush() override;
+
+private:
+    FramebufferSink() = default;
+
+    void draw(char c);
+    void newline();
+    void dirty(uint32_t first, uint32_t last);
+
+    volatile uint8_t* m_screen;
+    uint32_t* m_shadow;
+    uint32_t m_pitch;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_foreground;
+
+    // Text cursor, in characters
+    uint32_t m_columns;
+    uint32_t m_rows;
+    uint32_t m_column;
+    uint32_t m_row;
+
+    // Pixel rows [m_dirty_first, m_dirty_last) need copying out
+    uint32_t m_dirty_first;
+    uint32_t m_dirty_last;
+};
@@ -3,7 +3,29 @@
 #include "logging.hpp"
 #include "allocator.hpp"
 #include "page_allocator.hpp"
+#include "page.hpp"
+#include "virtual_allocator.hpp"
 #include "boot_information.hpp"
+#include "paging.hpp"
+#include "descriptors.hpp"
+#include "cpu.hpp"
+#include "cxxabi.hpp"
+#include "interrupts.hpp"
+#include "tlb.hpp"
+#include "pic.hpp"
+#include "ioapic.hpp"
+#include "serial.hpp"
+#include "e1000.hpp"
+#include "udp_sink.hpp"
+#include "framebuffer.hpp"
+#include "acpi.hpp"
+#include "smp.hpp"
+#include "apic.hpp"
+#include "string.hpp"
+
+// Bounds of the .nomap.reclaim section, from the linker script
+extern "C" char reclaim_start[];
+extern "C" char reclaim_end[];
 
 static const char* tag_names[] = {
     "end",
@@ -30,15 +52,21 @@ static const char* tag_names[] = {
 
 // The multiboot tags we care about, broken out for us to parse later
 struct multiboot {
+    uintptr_t info = 0;
+    size_t info_size = 0;
+
     const Multiboot::TagMmap* mmap = 0;
     const Multiboot::TagElfSections* shdr = 0;
     const Multiboot::TagOldAcpi *acpi_old = 0;
     const Multiboot::TagNewAcpi *acpi_new = 0;
     const Multiboot::TagCommandLine *cmd_line = 0;
+    const Multiboot::TagFramebuffer *framebuffer = 0;
 };
 
 bool read_multiboot_tags(uintptr_t descriptor, multiboot* mb) {
     auto info = Multiboot::Information(descriptor);
+    mb->info = descriptor;
+    mb->info_size = info.size();
     for(const auto& tag : info) {
 
 #define EXTRACT_TAG(field, class)                       \
@@ -50,6 +78,7 @@ bool read_multiboot_tags(uintptr_t descriptor, multiboot* mb) {
         EXTRACT_TAG(acpi_old, OldAcpi);
         EXTRACT_TAG(acpi_new, NewAcpi);
         EXTRACT_TAG(cmd_line, CommandLine);
+        EXTRACT_TAG(framebuffer, Framebuffer);
     }
 
 #define CHECK_TAG(field, class) \
@@ -73,10 +102,49 @@ bool read_multiboot_tags(uintptr_t descriptor, multiboot* mb) {
     return true;
 }
 
+// Maps everything the memory map describes as memory at
+// PHYSICAL_MAPPING, and moves the physical window over to it. Reserved
+// ranges are left out, since they're likely device memory that needs
+// to be mapped with the right cache settings. PageTable::map uses the
+// largest pages it can, so on most machines this takes a handful of
+// tables.
+void build_direct_map(multiboot& mb) {
+    using Type = Multiboot::TagMmap::Entry::Type;
+    auto table = PageTable::current();
+    size_t mapped = 0;
+    for (const auto& entry : *mb.mmap) {
+        if (entry.type == Type::Reserved || entry.type == Type::BadRam) {
+            continue;
+        }
+        auto start = entry.addr & ~PAGE_MASK;
+        auto end = (entry.addr + entry.len + PAGE_MASK) & ~PAGE_MASK;
+        if (end > PHYSICAL_MAPPING_SIZE) {
+            end = PHYSICAL_MAPPING_SIZE;
+        }
+        if (start >= end) {
+            continue;
+        }
+        if (!table.map(start, PHYSICAL_MAPPING + start, end - start)) {
+            klog("Could not map ", start, ":", end, " into the direct map\n");
+            continue;
+        }
+        mapped += end - start;
+    }
+
+    PhysicalWindow::base = PHYSICAL_MAPPING;
+    PhysicalWindow::size = PHYSICAL_MAPPING_SIZE;
+    klog("Direct mapped ", mapped, " bytes using ",
+         CpuFeatures::global().huge_pages ? "1G" : "2M", " pages\n");
+}
+
 void initialize_page_allocator (multiboot& mb, PageAllocator& alloc) {
+    uintptr_t max_addr = 0;
     for (const auto& entry : *mb.mmap) {
         if (entry.type == Multiboot::TagMmap::Entry::Type::Available) {
             alloc.add_region(entry.addr, entry.len);
+            if (entry.addr + entry.len > max_addr) {
+                max_addr = entry.addr + entry.len;
+            }
         }
     }
     for (const auto& entry : *mb.mmap) {
@@ -84,6 +152,15 @@ void initialize_page_allocator (multiboot& mb, PageAllocator& alloc) {
             alloc.reserve_region(entry.addr, entry.len);
         }
     }
+    // Physical page 0 is never handed out, so a zero address can
+    // signal allocation failure.
+    alloc.reserve_region(0, PAGE_SIZE);
+    // Hold on to the multiboot information until we're done with
+    // it. reclaim_boot_memory gives it back.
+    alloc.reserve_region(mb.info, mb.info_size);
+    // Application processors start in real mode, so their trampoline
+    // needs a permanent home in the first 1MB.
+    alloc.reserve_region(SMP_TRAMPOLINE, SMP_TRAMPOLINE_SIZE);
 
     for (const auto& section : *mb.shdr) {
         if (section.type && section.addr) {
@@ -91,33 +168,186 @@ void initialize_page_allocator (multiboot& mb, PageAllocator& alloc) {
             alloc.reserve_region(addr, section.size);
         }
     }
+    // .percpu is linked at 0, so the loop above skips it, but every
+    // CPU's copy is made from what was loaded for it
+    alloc.reserve_region(percpu_image_phys(), percpu_size());
+
+    // The buddy allocator's bitmaps and the page database may well
+    // end up above the boot identity map, so we need the direct map
+    // first. Its page tables come straight out of the regions above.
+    build_direct_map(mb);
+    alloc.init();
+
+    PageDatabase::init(max_addr);
+    for (const auto& entry : *mb.mmap) {
+        if (entry.type == Multiboot::TagMmap::Entry::Type::Available) {
+            PageDatabase::populate(entry.addr, entry.len);
+        }
+    }
+    PageDatabase::activate();
+}
+
+// Once we've copied out everything we need from the bootloader, the
+// multiboot information and the .nomap.reclaim section (multiboot
+// header, boot GDT/IDT and boot page tables) can be freed.
+void reclaim_boot_memory(multiboot& mb, PageAllocator& alloc) {
+    auto start = (uintptr_t)reclaim_start;
+    auto end = (uintptr_t)reclaim_end;
+
+    if (!PageTable::relocate(start, end)) {
+        klog("Keeping boot memory\n");
+        return;
+    }
+    load_cpu_descriptors(KERNEL_STACK_TOP);
+
+    alloc.add_region(start, end - start);
+
+    // Nothing refers to low memory through the identity map any more,
+    // so drop it. relocate gave the kernel mapping its own page
+    // directory, so the kernel stays put. From here on, device memory
+    // has to be mapped explicitly, with the right MemoryType.
+    PageTable::current().unmap(0, BOOT_IDENTITY_SIZE);
+
+    // reserve_region held back every page the information touched,
+    // so that's what we give back.
+    auto info_start = mb.info & ~PAGE_MASK;
+    auto info_end = (mb.info + mb.info_size + PAGE_MASK) & ~PAGE_MASK;
+    alloc.add_region(info_start, info_end - info_start);
+    mb.info = 0;
+
+    klog("Reclaimed ", (end - start) + (info_end - info_start), " bytes of boot memory\n");
+}
+
+// Picks the log sink from `log=` on the command line: `log=fb` for the
+// framebuffer console, or `log=udp:a.b.c.d:port`. Serial is the
+// default, and what we fall back to if the one asked for can't be set
+// up. `fb` is null if the bootloader didn't give us a framebuffer.
+static void select_log_sink(const char* cmdline, const FramebufferInfo* fb) {
+    auto log = cmdline_option(cmdline, "log");
+    if (!log) {
+        return;
+    }
+
+    if (log[0] == 'f' && log[1] == 'b' && (log[2] == ' ' || log[2] == 0)) {
+        if (!fb) {
+            klog("No framebuffer for log=fb, logging to serial\n");
+            return;
+        }
+        auto sink = FramebufferSink::create(*fb);
+        if (sink) {
+            Logger::global().drain();
+            Logger::global().sink(sink);
+        }
+        return;
+    }
+
+    if (log[0] != 'u' || log[1] != 'd' || log[2] != 'p' || log[3] != ':') {
+        klog("Unknown log sink, logging to serial\n");
+        return;
+    }
+
+    uint32_t ip;
+    uint16_t port;
+    if (!UdpSink::parse(log + 4, ip, port)) {
+        klog("Bad address for log=udp:, logging to serial\n");
+        return;
+    }
+    auto nic = E1000::probe();
+    if (!nic) {
+        klog("No e1000 for log=udp:, logging to serial\n");
+        return;
+    }
+
+    klog("Logging to UDP port ", udec(port), "\n");
+    Logger::global().drain();
+    Logger::global().sink(new UdpSink(nic, ip, port));
+}
+
+// Silences the PICs and brings up the boot CPU's local APIC and the
+// I/O APICs from the MADT. Returns false if there's no local APIC to
+// use, in which case no device interrupts are routed anywhere.
+static bool init_interrupt_controllers(const BootInfo& info) {
+    Pic::init();
+    if (!Acpi::init(info.acpi)) {
+        return false;
+    }
+    auto& madt = Acpi::madt();
+    auto& apic = LocalApic::global();
+    if (!apic.init(madt.local_apic)) {
+        klog("Couldn't map the local APIC\n");
+        return false;
+    }
+    apic.enable();
+    cpu_local(0).apic_id = apic.id();
+    if (!IoApic::init(madt)) {
+        klog("No usable I/O APIC\n");
+    }
+    return true;
+}
+
+// Starts every other processor the MADT lists. They go straight to
+// their idle loops.
+static void start_cpus() {
+    auto& madt = Acpi::madt();
+    if (madt.num_cpus < 2) {
+        return;
+    }
+    // Everyone has to be able to take shootdowns before there's anyone
+    // to send them to
+    Tlb::init_shootdown();
+    Smp::init_trampoline();
+    auto boot_cpu = cpu_local(0).apic_id;
+    for (size_t i = 0; i < madt.num_cpus; ++i) {
+        if (madt.apic_ids[i] != boot_cpu) {
+            Smp::start_cpu(madt.apic_ids[i]);
+        }
+    }
+    klog("Running on ", udec(cpu_count()), " CPUs\n");
 }
 
 extern "C" BootInfo* kinit(uint32_t magic, uint32_t multiboot_ptr) {
+    // The init phase. The core singletons are constant-initialized,
+    // so all that's left is this, in order. Logging needs to know
+    // which CPU it's on, so that comes first; anything logged before
+    // the log has a sink waits in the ring.
+    init_boot_percpu();
+    cpu_local(0).stack_top = KERNEL_STACK_TOP;
+    run_global_constructors();
+    SerialSink::global().init();
+    Logger::global().init(Sink::global());
+
     if(MULTIBOOT2_BOOTLOADER_MAGIC != magic) {
         klog("Not loaded from a multiboot2-compliant bootloader");
         return nullptr;
     }
 
-    Allocator::global().add_region(KERNEL_HEAP_START, 0x8000);
+    // Page faults are how the heap and other demand paged regions get
+    // their memory, so this has to come before anything allocates.
+    init_interrupts();
+    Tlb::init();
+    PageTable::init_memory_types();
 
-    // We want to stash a few values from the multiboot tags before we
-    // initialize our memory management, as we will likely overwrite
-    // Grub's data structures if we don't.
+    // The multiboot information is reserved until reclaim_boot_memory,
+    // so the tags stay valid while we set up memory management and
+    // copy out what we need.
     multiboot tags;
     if (!read_multiboot_tags((uintptr_t)multiboot_ptr, &tags)) {
         return nullptr;
     }
 
-    if (tags.acpi_new) {
-        // TODO: Get XSDT pointer
-    } else if (tags.acpi_old) {
-        // TODO: Get RSDT pointer
-    } else {
+    // The RSDP is copied into boot_info below, and read once we can
+    // map the tables it points to.
+    if (!tags.acpi_new && !tags.acpi_old) {
         klog("Could not find ACPI tables.");
         return nullptr;
     }
 
+    // The heap starts out empty and grows with pages from the page
+    // allocator, so it has to wait until that's up.
+    initialize_page_allocator(tags, PageAllocator::global());
+    Allocator::global().init(KERNEL_HEAP_START, 0);
+    VirtualAllocator::global().init(KERNEL_VMALLOC_START, KERNEL_VMALLOC_END - KERNEL_VMALLOC_START);
+
     auto boot_info = new BootInfo;
     boot_info->elf.shnum = tags.shdr->num;
     boot_info->elf.shndx = tags.shdr->shndx;
@@ -130,53 +360,57 @@ extern "C" BootInfo* kinit(uint32_t magic, uint32_t multiboot_ptr) {
 
     boot_info->cmdline = String(tags.cmd_line->string);
 
-    initialize_page_allocator(tags, PageAllocator::global());
+    auto rsdp = tags.acpi_new ? tags.acpi_new->rsdp : tags.acpi_old->rsdp;
+    auto rsdp_size = (tags.acpi_new ? tags.acpi_new->size : tags.acpi_old->size) - 8;
+    if (rsdp_size > sizeof(boot_info->acpi.rsdp)) {
+        rsdp_size = sizeof(boot_info->acpi.rsdp);
+    }
+    for (size_t i = 0; i < rsdp_size; ++i) {
+        boot_info->acpi.rsdp[i] = rsdp[i];
+    }
+    boot_info->acpi.rsdp_size = rsdp_size;
 
-    // Below here, we risk clobbering any multiboot data, since we're
-    // allocating pages.
+    // The framebuffer isn't anyone else's business yet, so it stays
+    // here rather than in boot_info
+    FramebufferInfo fb;
+    bool have_fb = tags.framebuffer &&
+        tags.framebuffer->framebuffer_type == Multiboot::TagFramebuffer::Type::Rgb;
+    if (have_fb) {
+        fb.phys = tags.framebuffer->addr;
+        fb.pitch = tags.framebuffer->pitch;
+        fb.width = tags.framebuffer->width;
+        fb.height = tags.framebuffer->height;
+        fb.bpp = tags.framebuffer->bpp;
+        fb.red_position = tags.framebuffer->red_position;
+        fb.green_position = tags.framebuffer->green_position;
+        fb.blue_position = tags.framebuffer->blue_position;
+    }
+
+    // Everything we need from the bootloader is in boot_info now.
+    reclaim_boot_memory(tags, PageAllocator::global());
+    // The kernel half's top-level entries are fixed from here on, so
+    // every address space cloned from this one sees all of it
+    PageTable::fill_kernel_half();
 
-    // TODO: create our real tables, and reclaim pages occupied by
-    // initial ones. This will put the kernel in HIGH MEMORY ONLY and
-    // any device memory will need to be mapped (with appropriate
-    // cache settings).
+    // Serial output is all that needs device interrupts for now.
+    // Everything else stays masked.
+    bool have_apic = init_interrupt_controllers(*boot_info);
+    SerialSink::global().interrupt_driven(true);
+    enable_interrupts();
 
-    // TODO: Where does ACPI go? Is it "PC platform"? "x86
-    // architecture"? Just an information-provider driver of some
-    // sort?  I *think* it needs to be in platform, since we need to
-    // know the number of processors to initialize the GDT. Possibly
-    // it's a thing that needs to be shared (e.g., it also needs to be
-    // enumerated to find devices). Maybe that's also platform - e.g.,
-    // do we walk ACPI stuff and create some sort of DeviceInfo object
-    // for each thing in it that the main kernel can then use to find
-    // drivers?
+    select_log_sink(boot_info->cmdline.str(), have_fb ? &fb : nullptr);
+    // `lockstats` counts contention on the tracked locks from here on,
+    // so it covers the other CPUs coming up. kmain reports it.
+    if (cmdline_option(boot_info->cmdline.str(), "lockstats")) {
+        enable_lock_stats();
+    }
+    if (have_apic) {
+        start_cpus();
+    }
 
     // The things below probably belong in kmain?
-    // TODO: setup interrupts/error handling
     // TODO: initialize userspace
     // TODO: initialize drivers
-    // TODO: switch logging to something based on a driver
 
     return boot_info;
 }
-
-struct SerialSink : public Sink {
-    SerialSink() {
-        asm volatile ("outb %b0, %w1" :: "a"(0x03), "Nd"(0x3fb));
-        asm volatile ("outb %b0, %w1" :: "a"(0xC7), "Nd"(0x3fa));
-    }
-
-    void writec(char c) {
-        uint8_t status;
-        do {
-            asm volatile("inb %w1, %b0" : "=a"(status) : "Nd"(0x3fd));
-        } while ((status & 0x20) == 0);
-        asm volatile ("outb %b0, %w1" :: "a"(c), "Nd"(0x3f8));
-    }
-};
-
-// TODO: Should this print to the VGA text console instead of serial?
-Sink* Sink::global() {
-    static SerialSink s;
-    return &s;
-
-}
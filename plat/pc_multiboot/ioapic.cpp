@@ -0,0 +1,133 @@
+#include "ioapic.hpp"
+#include "logging.hpp"
+#include "spinlock.hpp"
+#include "virtual_allocator.hpp"
+
+// Registers are reached indirectly, by writing the index to IOREGSEL
+// and then going through IOWIN
+#define IOREGSEL 0x00
+#define IOWIN 0x10
+
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10
+
+#define REDIRECT_ACTIVE_LOW (1 << 13)
+#define REDIRECT_LEVEL (1 << 15)
+#define REDIRECT_MASKED (1 << 16)
+
+// MPS INTI flags, as the MADT overrides give them. 0 in either field
+// means whatever the bus normally does, which for ISA is active high
+// and edge triggered.
+#define INTI_POLARITY_MASK 0x3
+#define INTI_POLARITY_LOW 0x3
+#define INTI_TRIGGER_MASK 0xc
+#define INTI_TRIGGER_LEVEL 0xc
+
+namespace {
+    struct Controller {
+        volatile uint32_t* regs;
+        uint32_t gsi_base;
+        uint32_t inputs;
+    };
+}
+
+static Controller controllers[ACPI_MAX_IOAPICS];
+static size_t num_controllers;
+static const Acpi::Madt* isa_madt;
+// IOREGSEL and IOWIN have to be used as a pair
+static SpinLock lock;
+
+static uint32_t read(Controller& c, uint32_t reg) {
+    c.regs[IOREGSEL / 4] = reg;
+    return c.regs[IOWIN / 4];
+}
+
+static void write(Controller& c, uint32_t reg, uint32_t value) {
+    c.regs[IOREGSEL / 4] = reg;
+    c.regs[IOWIN / 4] = value;
+}
+
+static Controller* find(uint32_t gsi) {
+    for (size_t i = 0; i < num_controllers; ++i) {
+        auto& c = controllers[i];
+        if (gsi >= c.gsi_base && gsi - c.gsi_base < c.inputs) {
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+// The GSI ISA IRQ `irq` comes in on, and its INTI flags
+static uint32_t isa_gsi(uint8_t irq, uint16_t& flags) {
+    flags = 0;
+    for (size_t i = 0; isa_madt && i < isa_madt->num_overrides; ++i) {
+        auto& o = isa_madt->overrides[i];
+        if (o.irq == irq) {
+            flags = o.flags;
+            return o.gsi;
+        }
+    }
+    return irq;
+}
+
+bool IoApic::init(const Acpi::Madt& madt) {
+    isa_madt = &madt;
+    for (size_t i = 0; i < madt.num_ioapics; ++i) {
+        auto& ioapic = madt.ioapics[i];
+        auto regs = VirtualAllocator::global().map_physical(ioapic.addr, IOWIN + 4,
+                                                            MemoryType::Uncached);
+        if (!regs) {
+            klog("Couldn't map I/O APIC ", udec(ioapic.id), "\n");
+            continue;
+        }
+
+        auto& c = controllers[num_controllers++];
+        c.regs = (volatile uint32_t*)regs;
+        c.gsi_base = ioapic.gsi_base;
+        c.inputs = ((read(c, IOAPIC_VERSION) >> 16) & 0xff) + 1;
+        for (uint32_t input = 0; input < c.inputs; ++input) {
+            write(c, IOAPIC_REDIRECTION + input * 2, REDIRECT_MASKED);
+            write(c, IOAPIC_REDIRECTION + input * 2 + 1, 0);
+        }
+        klog("I/O APIC ", udec(ioapic.id), ": GSIs ", udec(c.gsi_base), "-",
+             udec(c.gsi_base + c.inputs - 1), "\n");
+    }
+    return num_controllers != 0;
+}
+
+bool IoApic::route_isa(uint8_t irq, uint8_t vector, uint32_t apic_id) {
+    uint16_t flags;
+    auto gsi = isa_gsi(irq, flags);
+    auto c = find(gsi);
+    if (!c) {
+        return false;
+    }
+
+    uint32_t low = vector;
+    if ((flags & INTI_POLARITY_MASK) == INTI_POLARITY_LOW) {
+        low |= REDIRECT_ACTIVE_LOW;
+    }
+    if ((flags & INTI_TRIGGER_MASK) == INTI_TRIGGER_LEVEL) {
+        low |= REDIRECT_LEVEL;
+    }
+
+    IrqSaveGuard<SpinLock> guard(lock);
+    auto input = gsi - c->gsi_base;
+    // Destination first, so the entry is never live with the wrong one
+    write(*c, IOAPIC_REDIRECTION + input * 2 + 1, apic_id << 24);
+    write(*c, IOAPIC_REDIRECTION + input * 2, low);
+    return true;
+}
+
+void IoApic::mask_isa(uint8_t irq) {
+    uint16_t flags;
+    auto gsi = isa_gsi(irq, flags);
+    auto c = find(gsi);
+    if (!c) {
+        return;
+    }
+
+    IrqSaveGuard<SpinLock> guard(lock);
+    auto reg = IOAPIC_REDIRECTION + (gsi - c->gsi_base) * 2;
+    write(*c, reg, read(*c, reg) | REDIRECT_MASKED);
+}
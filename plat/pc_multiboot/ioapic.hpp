@@ -0,0 +1,23 @@
+#pragma once
+
+#include "stdint.h"
+#include "acpi.hpp"
+
+// ISA IRQ numbers, before any MADT override is applied
+#define IRQ_COM1 4
+
+// The I/O APICs, which take device interrupts over from the PICs. Each
+// input is routed to one vector on one CPU.
+namespace IoApic {
+    // Maps every I/O APIC in `madt` and masks all of their inputs.
+    // Returns false if there are none we can use.
+    bool init(const Acpi::Madt& madt);
+
+    // Routes ISA IRQ `irq` to `vector` on the CPU with local APIC ID
+    // `apic_id`, and unmasks it. The MADT's overrides decide which
+    // input that is and how it's triggered. Returns false if no I/O
+    // APIC has the input.
+    bool route_isa(uint8_t irq, uint8_t vector, uint32_t apic_id);
+
+    void mask_isa(uint8_t irq);
+}
@@ -166,6 +166,34 @@ namespace Multiboot {
         }
     };
 
+    struct TagFramebuffer {
+        static constexpr int Id = 8;
+
+        enum class Type : uint8_t {
+            Indexed = 0,
+            Rgb = 1,
+            EgaText = 2,
+        };
+
+        uint32_t type;
+        uint32_t size;
+        uint64_t addr;
+        uint32_t pitch;
+        uint32_t width;
+        uint32_t height;
+        uint8_t bpp;
+        Type framebuffer_type;
+        uint16_t reserved;
+
+        // Only meaningful for Type::Rgb
+        uint8_t red_position;
+        uint8_t red_size;
+        uint8_t green_position;
+        uint8_t green_size;
+        uint8_t blue_position;
+        uint8_t blue_size;
+    };
+
     struct TagOldAcpi {
         static constexpr int Id = 14;
 
@@ -225,6 +253,10 @@ namespace Multiboot {
     public:
         Information(uintptr_t address) : address(address) {}
 
+        size_t size() const {
+            return reinterpret_cast<Header*>(address)->size;
+        }
+
         Iterator begin() const {
             auto end = address + reinterpret_cast<Header*>(address)->size;
             return Iterator {address + sizeof(Header), end};
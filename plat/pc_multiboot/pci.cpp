@@ -0,0 +1,86 @@
+#include "pci.hpp"
+#include "cpu.hpp"
+
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_HEADER_TYPE 0x0e
+#define PCI_BAR0 0x10
+
+// Vendor ID of an empty slot
+#define PCI_NO_VENDOR 0xffff
+
+#define COMMAND_MEMORY 0x02
+#define COMMAND_BUS_MASTER 0x04
+
+#define HEADER_MULTIFUNCTION 0x80
+
+#define BAR_IO 0x01
+#define BAR_TYPE_MASK 0x06
+#define BAR_TYPE_64 0x04
+
+static void select(Pci::Address addr, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, 0x80000000 | addr.bus << 16 | addr.device << 11 |
+         addr.function << 8 | (offset & 0xfc));
+}
+
+uint32_t Pci::read32(Address addr, uint8_t offset) {
+    select(addr, offset);
+    return inl(PCI_CONFIG_DATA);
+}
+
+void Pci::write32(Address addr, uint8_t offset, uint32_t value) {
+    select(addr, offset);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+uint16_t Pci::read16(Address addr, uint8_t offset) {
+    return read32(addr, offset) >> ((offset & 2) * 8);
+}
+
+void Pci::write16(Address addr, uint8_t offset, uint16_t value) {
+    auto shift = (offset & 2) * 8;
+    auto word = read32(addr, offset) & ~(0xffffu << shift);
+    write32(addr, offset, word | (uint32_t)value << shift);
+}
+
+bool Pci::find(uint16_t vendor, uint16_t device, Address& out) {
+    for (unsigned bus = 0; bus < 256; ++bus) {
+        for (uint8_t dev = 0; dev < 32; ++dev) {
+            Address addr = {(uint8_t)bus, dev, 0};
+            if (read16(addr, PCI_VENDOR_ID) == PCI_NO_VENDOR) {
+                continue;
+            }
+            uint8_t functions = (read32(addr, PCI_HEADER_TYPE) >> 16) & HEADER_MULTIFUNCTION ? 8 : 1;
+            for (addr.function = 0; addr.function < functions; ++addr.function) {
+                if (read16(addr, PCI_VENDOR_ID) == vendor &&
+                    read16(addr, PCI_DEVICE_ID) == device) {
+                    out = addr;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+uintptr_t Pci::memory_bar(Address addr, unsigned bar) {
+    uint8_t offset = PCI_BAR0 + bar * 4;
+    auto low = read32(addr, offset);
+    if (low & BAR_IO) {
+        return 0;
+    }
+    uintptr_t base = low & ~0xfu;
+    if ((low & BAR_TYPE_MASK) == BAR_TYPE_64) {
+        base |= (uintptr_t)read32(addr, offset + 4) << 32;
+    }
+    return base;
+}
+
+void Pci::enable_bus_master(Address addr) {
+    auto command = read16(addr, PCI_COMMAND);
+    write16(addr, PCI_COMMAND, command | COMMAND_MEMORY | COMMAND_BUS_MASTER);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "stdint.h"
+
+// PCI configuration space through the legacy 0xCF8/0xCFC ports. That
+// only reaches the first 256 bytes of each function, which is all we
+// need so far.
+namespace Pci {
+    struct Address {
+        uint8_t bus;
+        uint8_t device;
+        uint8_t function;
+    };
+
+    uint32_t read32(Address addr, uint8_t offset);
+    void write32(Address addr, uint8_t offset, uint32_t value);
+    uint16_t read16(Address addr, uint8_t offset);
+    void write16(Address addr, uint8_t offset, uint16_t value);
+
+    // Looks for a function with these IDs, scanning every bus. Returns
+    // false if there isn't one.
+    bool find(uint16_t vendor, uint16_t device, Address& out);
+
+    // Returns the physical address of memory BAR `bar`, or 0 if it's
+    // an I/O BAR
+    uintptr_t memory_bar(Address addr, unsigned bar);
+
+    // Lets the function decode its memory BARs and do DMA
+    void enable_bus_master(Address addr);
+}
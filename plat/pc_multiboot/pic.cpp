@@ -0,0 +1,27 @@
+#include "pic.hpp"
+#include "cpu.hpp"
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+
+#define ICW1_INIT 0x11
+#define ICW4_8086 0x01
+
+// The slave PIC hangs off this line of the master
+#define IRQ_CASCADE 2
+
+void Pic::init() {
+    outb(PIC1_COMMAND, ICW1_INIT);
+    outb(PIC2_COMMAND, ICW1_INIT);
+    outb(PIC1_DATA, PIC_VECTOR_BASE);
+    outb(PIC2_DATA, PIC_VECTOR_BASE + 8);
+    outb(PIC1_DATA, 1 << IRQ_CASCADE);
+    outb(PIC2_DATA, IRQ_CASCADE);
+    outb(PIC1_DATA, ICW4_8086);
+    outb(PIC2_DATA, ICW4_8086);
+
+    outb(PIC1_DATA, 0xff);
+    outb(PIC2_DATA, 0xff);
+}
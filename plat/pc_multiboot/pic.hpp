@@ -0,0 +1,17 @@
+#pragma once
+
+#include "stdint.h"
+#include "interrupts.hpp"
+
+// Legacy IRQs are remapped to start here, clear of the CPU exceptions
+#define PIC_VECTOR_BASE VECTOR_LEGACY_FIRST
+
+// The pair of 8259s every PC still pretends to have. Device interrupts
+// go through the I/O APIC instead, so all the PICs need is to be kept
+// quiet.
+namespace Pic {
+    // Remaps both PICs above the exception vectors and masks every
+    // line, so the odd spurious interrupt they still raise lands
+    // somewhere harmless.
+    void init();
+}
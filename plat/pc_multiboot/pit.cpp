@@ -0,0 +1,42 @@
+#include "smp.hpp"
+#include "cpu.hpp"
+
+// Channel 2 of the PIT, the one wired to the PC speaker, is the only
+// one whose output we can read back. It counts down at this rate.
+#define PIT_HZ 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+// Channel 2, low then high byte, mode 0 (interrupt on terminal count)
+#define PIT_CHANNEL2_ONESHOT 0xb0
+
+// Port B of the keyboard controller: channel 2's gate, its speaker
+// output, and its output readback
+#define PORT_B 0x61
+#define PORT_B_GATE 0x01
+#define PORT_B_SPEAKER 0x02
+#define PORT_B_OUT2 0x20
+
+// Longest delay one countdown can manage, with a 16-bit count
+#define PIT_MAX_US 50000
+
+void delay_us(uint32_t us) {
+    while (us) {
+        auto chunk = us < PIT_MAX_US ? us : PIT_MAX_US;
+        us -= chunk;
+        uint32_t count = (uint64_t)chunk * PIT_HZ / 1000000;
+        if (!count) {
+            count = 1;
+        }
+
+        auto port_b = (inb(PORT_B) & ~PORT_B_SPEAKER) & ~PORT_B_GATE;
+        outb(PORT_B, port_b);
+        outb(PIT_COMMAND, PIT_CHANNEL2_ONESHOT);
+        outb(PIT_CHANNEL2, count);
+        outb(PIT_CHANNEL2, count >> 8);
+        // Raising the gate starts the count
+        outb(PORT_B, port_b | PORT_B_GATE);
+        while (!(inb(PORT_B) & PORT_B_OUT2)) {
+            cpu_relax();
+        }
+    }
+}
@@ -0,0 +1,151 @@
+#include "serial.hpp"
+#include "cpu.hpp"
+#include "interrupts.hpp"
+#include "ioapic.hpp"
+
+#define COM1 0x3f8
+#define UART_DATA (COM1 + 0)
+#define UART_IER (COM1 + 1)
+#define UART_IIR (COM1 + 2)
+#define UART_FCR (COM1 + 2)
+#define UART_LCR (COM1 + 3)
+#define UART_MCR (COM1 + 4)
+#define UART_LSR (COM1 + 5)
+
+#define UART_FIFO_SIZE 16
+
+// LSR: the transmit FIFO is empty
+#define LSR_THRE 0x20
+// IIR: no interrupt is pending
+#define IIR_NONE_PENDING 0x01
+// IER: interrupt when the transmit FIFO is empty
+#define IER_THRE 0x02
+// MCR: DTR, RTS, and OUT2, which gates the IRQ line on PCs
+#define MCR_IRQ 0x0b
+
+__constinit SerialSink SerialSink::instance;
+
+void SerialSink::init() {
+    // 8N1, and enable and clear the FIFOs
+    outb(UART_LCR, 0x03);
+    outb(UART_FCR, 0xC7);
+}
+
+void SerialSink::writec(char c) {
+    write(&c, 1);
+}
+
+void SerialSink::write_polled(const char* str, size_t length) {
+    while (length) {
+        while ((inb(UART_LSR) & LSR_THRE) == 0) {
+            cpu_relax();
+        }
+        // THRE means the whole FIFO is empty, so it can take up to 16
+        // bytes without checking again.
+        auto count = length < UART_FIFO_SIZE ? length : UART_FIFO_SIZE;
+        for (size_t i = 0; i < count; ++i) {
+            outb(UART_DATA, str[i]);
+        }
+        str += count;
+        length -= count;
+    }
+}
+
+void SerialSink::write(const char* str, size_t length) {
+    if (!m_interrupts) {
+        write_polled(str, length);
+        return;
+    }
+
+    while (length) {
+        auto enabled = save_interrupts();
+        // If the ring is full, wait for the interrupt handler to make
+        // room. With interrupts off it never will, so just fall back
+        // to polling.
+        if (m_head - m_tail == SERIAL_TX_RING) {
+            if (!enabled) {
+                // Let the ring drain first, so output stays in order
+                while (m_head != m_tail) {
+                    while ((inb(UART_LSR) & LSR_THRE) == 0) {
+                        cpu_relax();
+                    }
+                    fill_fifo();
+                }
+                write_polled(str, length);
+                return;
+            }
+            restore_interrupts(enabled);
+            cpu_relax();
+            continue;
+        }
+        while (length && m_head - m_tail < SERIAL_TX_RING) {
+            m_ring[m_head % SERIAL_TX_RING] = *str++;
+            m_head++;
+            length--;
+        }
+        if (!m_busy) {
+            fill_fifo();
+        }
+        restore_interrupts(enabled);
+    }
+}
+
+void SerialSink::fill_fifo() {
+    if (inb(UART_LSR) & LSR_THRE) {
+        for (size_t i = 0; i < UART_FIFO_SIZE && m_tail != m_head; ++i) {
+            outb(UART_DATA, m_ring[m_tail % SERIAL_TX_RING]);
+            m_tail++;
+        }
+    }
+    // Keep the interrupt enabled for as long as there's anything left
+    // to send, including the bytes we just put in the FIFO.
+    bool busy = m_tail != m_head || !(inb(UART_LSR) & LSR_THRE);
+    if (busy != m_busy) {
+        outb(UART_IER, busy ? IER_THRE : 0);
+        m_busy = busy;
+    }
+}
+
+bool SerialSink::irq(InterruptFrame*, void*) {
+    auto& sink = global();
+    // Reading IIR acknowledges the transmitter-empty interrupt
+    bool pending = !(inb(UART_IIR) & IIR_NONE_PENDING);
+    sink.fill_fifo();
+    return pending;
+}
+
+void SerialSink::interrupt_driven(bool enabled) {
+    auto were_enabled = save_interrupts();
+    if (enabled && !m_interrupts) {
+        if (!m_vector && (m_vector = alloc_interrupt_vector())) {
+            add_interrupt_handler(m_vector, m_action);
+        }
+        if (!m_vector || !IoApic::route_isa(IRQ_COM1, m_vector, this_cpu(cpu_local_data).apic_id)) {
+            restore_interrupts(were_enabled);
+            return;
+        }
+        outb(UART_MCR, MCR_IRQ);
+        m_interrupts = true;
+        fill_fifo();
+    } else if (!enabled && m_interrupts) {
+        // Flush whatever is still queued before going back to polling
+        while (m_head != m_tail) {
+            while ((inb(UART_LSR) & LSR_THRE) == 0) {
+                cpu_relax();
+            }
+            fill_fifo();
+        }
+        outb(UART_IER, 0);
+        IoApic::mask_isa(IRQ_COM1);
+        m_interrupts = false;
+        m_busy = false;
+    }
+    restore_interrupts(were_enabled);
+}
+
+// Serial works as soon as kinit's init phase has set it up. kinit
+// moves the log to the framebuffer or the network later if the
+// command line asks for it.
+Sink* Sink::global() {
+    return &SerialSink::global();
+}
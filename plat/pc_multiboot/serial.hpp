@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "logging.hpp"
+#include "interrupts.hpp"
+
+// Bytes buffered for the transmitter in interrupt-driven mode
+#define SERIAL_TX_RING 4096
+
+// COM1, a 16550 with its 16-byte FIFO enabled. Each wait for the
+// transmitter to go idle is followed by a whole FIFO's worth of bytes.
+//
+// In interrupt-driven mode, writes go into a ring and return straight
+// away. The transmitter-empty interrupt refills the FIFO from the ring
+// until it's empty.
+class SerialSink : public Sink {
+public:
+    static SerialSink& global() { return instance; }
+
+    // Programs the UART. Part of kinit's init phase, before the log
+    // has anywhere to go.
+    void init();
+
+    void writec(char c) override;
+    void write(const char* str, size_t length) override;
+
+    // Switches to interrupt-driven mode and back. COM1 is routed
+    // through the I/O APIC to the calling CPU; if that can't be done,
+    // writes stay polled.
+    void interrupt_driven(bool enabled);
+
+private:
+    constexpr SerialSink()
+        : m_ring(), m_head(), m_tail(), m_interrupts(), m_busy(), m_vector(),
+          m_action{irq, nullptr, "COM1", nullptr} {}
+
+    static SerialSink instance;
+
+    void write_polled(const char* str, size_t length);
+    // Moves up to a FIFO's worth of bytes from the ring into the
+    // transmitter. Interrupts must be disabled.
+    void fill_fifo();
+
+    static bool irq(InterruptFrame* frame, void* context);
+
+    char m_ring[SERIAL_TX_RING];
+    // Written by write(), and by the interrupt handler
+    uint32_t m_head;
+    uint32_t m_tail;
+    bool m_interrupts;
+    // Whether the transmitter-empty interrupt is enabled, i.e. there's
+    // a refill coming
+    bool m_busy;
+    // 0 until interrupt_driven first allocates one
+    uint8_t m_vector;
+    InterruptAction m_action;
+};
@@ -0,0 +1,138 @@
+#include "udp_sink.hpp"
+#include "e1000.hpp"
+
+#define ETHERTYPE_IPV4 0x0800
+#define IP_PROTO_UDP 17
+#define IP_TTL 64
+#define IP_DONT_FRAGMENT 0x4000
+
+// Offsets of the fields that change per datagram
+#define IP_HEADER 14
+#define IP_TOTAL_LENGTH (IP_HEADER + 2)
+#define IP_ID (IP_HEADER + 4)
+#define IP_CHECKSUM (IP_HEADER + 10)
+#define UDP_HEADER (IP_HEADER + 20)
+#define UDP_LENGTH (UDP_HEADER + 4)
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    put16(p, value >> 16);
+    put16(p + 2, value);
+}
+
+UdpSink::UdpSink(E1000* nic, uint32_t ip, uint16_t port)
+    : m_nic(nic), m_header(), m_ip_id(0), m_packet(nullptr), m_payload(0) {
+    auto h = m_header;
+    for (int i = 0; i < 6; ++i) {
+        h[i] = 0xff;
+        h[6 + i] = nic->mac()[i];
+    }
+    put16(h + 12, ETHERTYPE_IPV4);
+
+    auto ip_header = h + IP_HEADER;
+    ip_header[0] = 0x45;
+    put16(ip_header + 6, IP_DONT_FRAGMENT);
+    ip_header[8] = IP_TTL;
+    ip_header[9] = IP_PROTO_UDP;
+    put32(ip_header + 12, UDP_SOURCE_IP);
+    put32(ip_header + 16, ip);
+
+    // Same port at both ends. The UDP checksum is optional over IPv4,
+    // so it's left as zero.
+    put16(h + UDP_HEADER, port);
+    put16(h + UDP_HEADER + 2, port);
+
+    m_header_sum = 0;
+    for (int i = 0; i < 20; i += 2) {
+        m_header_sum += ip_header[i] << 8 | ip_header[i + 1];
+    }
+}
+
+bool UdpSink::parse(const char* spec, uint32_t& ip, uint16_t& port) {
+    ip = 0;
+    for (int octet = 0; octet < 4; ++octet) {
+        uint32_t value = 0;
+        auto start = spec;
+        while (*spec >= '0' && *spec <= '9') {
+            value = value * 10 + (*spec++ - '0');
+        }
+        if (spec == start || value > 255 || *spec++ != (octet == 3 ? ':' : '.')) {
+            return false;
+        }
+        ip = ip << 8 | value;
+    }
+
+    uint32_t value = 0;
+    auto start = spec;
+    while (*spec >= '0' && *spec <= '9') {
+        value = value * 10 + (*spec++ - '0');
+    }
+    if (spec == start || value == 0 || value > 0xffff || (*spec && *spec != ' ')) {
+        return false;
+    }
+    port = value;
+    return true;
+}
+
+void UdpSink::writec(char c) {
+    write(&c, 1);
+}
+
+void UdpSink::write(const char* str, size_t length) {
+    while (length) {
+        if (!m_packet) {
+            m_packet = m_nic->tx_buffer();
+            for (size_t i = 0; i < UDP_HEADERS; ++i) {
+                m_packet[i] = m_header[i];
+            }
+            m_payload = 0;
+        }
+
+        // Keep records in one datagram where they fit, so a lost
+        // packet doesn't leave half a line behind
+        auto space = UDP_MAX_PAYLOAD - m_payload;
+        if (length > space && m_payload) {
+            send();
+            continue;
+        }
+        auto count = length < space ? length : space;
+        auto payload = m_packet + UDP_HEADERS + m_payload;
+        for (size_t i = 0; i < count; ++i) {
+            payload[i] = str[i];
+        }
+        m_payload += count;
+        str += count;
+        length -= count;
+        if (m_payload == UDP_MAX_PAYLOAD) {
+            send();
+        }
+    }
+}
+
+void UdpSink::flush() {
+    if (m_packet && m_payload) {
+        send();
+    }
+}
+
+void UdpSink::send() {
+    uint16_t ip_length = 20 + 8 + m_payload;
+    uint16_t id = m_ip_id++;
+    put16(m_packet + IP_TOTAL_LENGTH, ip_length);
+    put16(m_packet + IP_ID, id);
+    put16(m_packet + UDP_LENGTH, 8 + m_payload);
+
+    uint32_t sum = m_header_sum + ip_length + id;
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    put16(m_packet + IP_CHECKSUM, ~sum);
+
+    m_nic->transmit(UDP_HEADERS + m_payload);
+    m_packet = nullptr;
+    m_payload = 0;
+}
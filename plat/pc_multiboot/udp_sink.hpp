@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+#include "logging.hpp"
+
+class E1000;
+
+// Ethernet, IPv4 and UDP headers in front of the payload
+#define UDP_HEADERS 42
+
+// Log bytes per datagram: a 1500 byte MTU less the IP and UDP headers
+#define UDP_MAX_PAYLOAD 1472
+
+// Who we say we are. This is the address QEMU's user-mode network
+// hands out, and nothing checks it.
+#define UDP_SOURCE_IP 0x0a00020f
+
+// Sends the log to a UDP listener, for `log=udp:a.b.c.d:port`. Records
+// are packed into a datagram until it's full or the logger flushes at
+// the end of a drain, so a busy log goes out in few, large packets.
+//
+// The headers are built once up front; sending only fills in the
+// lengths, the IP ID and the IP checksum. We never receive anything,
+// so there's no ARP: frames go to the broadcast MAC, which QEMU's
+// user-mode network takes happily.
+class UdpSink : public Sink {
+public:
+    UdpSink(E1000* nic, uint32_t ip, uint16_t port);
+
+    // Parses "a.b.c.d:port". Returns false if it's malformed.
+    static bool parse(const char* spec, uint32_t& ip, uint16_t& port);
+
+    void writec(char c) override;
+    void write(const char* str, size_t length) override;
+    void flush() override;
+
+private:
+    void send();
+
+    E1000* m_nic;
+    uint8_t m_header[UDP_HEADERS];
+    // One's complement sum of the IP header with the length, ID and
+    // checksum left as zero
+    uint32_t m_header_sum;
+    uint16_t m_ip_id;
+    // The datagram being filled, or nullptr if there isn't one yet
+    uint8_t* m_packet;
+    size_t m_payload;
+};
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Turns a captured log stream with binary ktrace frames back into text.
+#
+#     ktrace_decode.py kernel serial.log
+#
+# Text in the stream is passed through untouched. Each frame is
+#
+#     0xff, length of the rest, cpu (u8), tsc (u64),
+#     format id (u32), argument count (u8), arguments (u64 each)
+#
+# all little endian. The format id is an offset into the kernel's
+# .ktrace section, so the ELF has to be the one that produced the log.
+
+import struct
+import sys
+
+FRAME_MARKER = 0xff
+
+
+def read_section(path, wanted):
+    with open(path, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 2:
+        sys.exit('%s is not a 64 bit ELF' % path)
+
+    shoff, = struct.unpack_from('<Q', elf, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x3a)
+
+    def header(i):
+        # name, type, flags, addr, offset, size
+        return struct.unpack_from('<IIQQQQ', elf, shoff + i * shentsize)
+
+    names = header(shstrndx)
+    for i in range(shnum):
+        name, _, _, _, offset, size = header(i)
+        start = names[4] + name
+        if elf[start:elf.index(b'\0', start)].decode() == wanted:
+            return elf[offset:offset + size]
+    sys.exit('%s has no %s section' % (path, wanted))
+
+
+def render(formats, id, args):
+    end = formats.index(b'\0', id)
+    fmt = formats[id:end].decode(errors='replace')
+    out = []
+    i = 0
+    arg = 0
+    while i < len(fmt):
+        c = fmt[i]
+        if c != '%' or i + 1 == len(fmt):
+            out.append(c)
+            i += 1
+            continue
+        spec = fmt[i + 1]
+        i += 2
+        if spec == '%' or arg == len(args):
+            out.append(spec)
+            continue
+        value = args[arg]
+        arg += 1
+        if spec == 'x':
+            out.append('0x%X' % value)
+        elif spec == 'd':
+            out.append('%d' % (value - (1 << 64) if value >> 63 else value))
+        else:
+            out.append('%d' % value)
+    return ''.join(out)
+
+
+def decode(formats, stream, out):
+    i = 0
+    while i < len(stream):
+        end = stream.find(bytes([FRAME_MARKER]), i)
+        if end < 0:
+            end = len(stream)
+        out.write(stream[i:end].decode(errors='replace'))
+        i = end
+        if i + 2 > len(stream):
+            break
+
+        length = stream[i + 1]
+        frame = stream[i + 2:i + 2 + length]
+        i += 2 + length
+        if len(frame) < 14:
+            out.write('[truncated ktrace frame]\n')
+            break
+        cpu, tsc, id, count = struct.unpack_from('<BQIB', frame)
+        args = struct.unpack_from('<%dQ' % count, frame, 14)
+        out.write('[cpu %d %d] %s' % (cpu, tsc, render(formats, id, args)))
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit('usage: %s kernel [log]' % sys.argv[0])
+    formats = read_section(sys.argv[1], '.ktrace')
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], 'rb') as f:
+            stream = f.read()
+    else:
+        stream = sys.stdin.buffer.read()
+    decode(formats, stream, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()